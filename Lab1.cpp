@@ -5,17 +5,265 @@
 #include <cmath>
 #include <cstdlib>
 #include <map>
+#include <unordered_map>
+#include <new>
+#include <utility>
+#include <type_traits>
 #include <ctime>
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <cctype>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <list>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define LAB1_HAS_SOCKETS 1
+#define LAB1_HAS_MMAP 1
+#else
+#define LAB1_HAS_SOCKETS 0
+#define LAB1_HAS_MMAP 0
+#endif
 
 using namespace std;
 
+// Built-in profiling. LAB1_PROFILE=0 compiles every probe below to nothing; otherwise a probe is one
+// predictable branch until --profile switches it on. Counters live per thread and are merged by profileFlush().
+#ifndef LAB1_PROFILE
+#define LAB1_PROFILE 1
+#endif
+
+enum class ProfilePhase { RoundReset, TargetSelect, Damage, Spell, GraphRebuild, Count };
+enum class ProfileEvent { Rounds, Turns, Attacks, SpellsCast, Kills, TargetScans, TargetComparisons, TargetUpdates, Count };
+
+const int ProfilePhaseCount = static_cast<int>(ProfilePhase::Count);
+const int ProfileEventCount = static_cast<int>(ProfileEvent::Count);
+
+const char* profilePhaseName(int phase) {
+    static const char* const names[] = { "round-reset", "target-select", "damage", "spell", "graph-rebuild" };
+    return names[phase];
+}
+
+const char* profileEventName(int event) {
+    static const char* const names[] = { "rounds", "turns", "attacks", "spellsCast", "kills",
+                                         "targetScans", "targetComparisons", "targetUpdates" };
+    return names[event];
+}
+
+struct ProfileCounters {
+    uint64_t cycles[ProfilePhaseCount];
+    uint64_t calls[ProfilePhaseCount];
+    uint64_t events[ProfileEventCount];
+
+    void merge(const ProfileCounters& other) {
+        for (int i = 0; i < ProfilePhaseCount; ++i) {
+            cycles[i] += other.cycles[i];
+            calls[i] += other.calls[i];
+        }
+        for (int i = 0; i < ProfileEventCount; ++i) events[i] += other.events[i];
+    }
+};
+
+// One Chrome trace "complete" event; times are microseconds since the first span.
+struct TraceSpan {
+    const char* name;
+    int thread;
+    long long begin;
+    long long duration;
+    long long rounds;
+};
+
+// Time stamp counter where there is one, nanoseconds elsewhere; only differences are ever used.
+inline uint64_t profileClock() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_ia32_rdtsc();
+#else
+    return static_cast<uint64_t>(chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+inline bool& profilingEnabled() {
+    static bool enabled = false;
+    return enabled;
+}
+
+inline bool& tracingEnabled() {
+    static bool enabled = false;
+    return enabled;
+}
+
+thread_local ProfileCounters threadProfile;
+thread_local vector<TraceSpan> threadTrace;
+
+struct ProfileTotals {
+    mutex lock;
+    ProfileCounters counters = {};
+    vector<TraceSpan> spans;
+    atomic<int> nextThread{ 0 };
+    chrono::steady_clock::time_point origin = chrono::steady_clock::now();
+};
+
+ProfileTotals& profileTotals() {
+    static ProfileTotals totals;
+    return totals;
+}
+
+inline void profileCount(ProfileEvent event, uint64_t amount = 1) {
+#if LAB1_PROFILE
+    if (profilingEnabled()) threadProfile.events[static_cast<int>(event)] += amount;
+#else
+    (void)event;
+    (void)amount;
+#endif
+}
+
+// Splits a stretch of work into consecutive phases: mark(p) charges the time since the previous mark to p.
+// It reads the switch once, so count() inside a loop costs a register test.
+class ProfileLap {
+#if LAB1_PROFILE
+private:
+    bool on;
+    uint64_t last;
+
+public:
+    ProfileLap() : on(profilingEnabled()), last(on ? profileClock() : 0) {}
+
+    void mark(ProfilePhase phase) {
+        if (!on) return;
+        uint64_t now = profileClock();
+        threadProfile.cycles[static_cast<int>(phase)] += now - last;
+        threadProfile.calls[static_cast<int>(phase)]++;
+        last = now;
+    }
+
+    void count(ProfileEvent event) {
+        if (on) threadProfile.events[static_cast<int>(event)]++;
+    }
+#else
+public:
+    void mark(ProfilePhase) {}
+    void count(ProfileEvent) {}
+#endif
+};
+
+// Records a trace span for its lifetime when --trace is on.
+class TraceScope {
+#if LAB1_PROFILE
+private:
+    const char* name;
+    long long rounds;
+    chrono::steady_clock::time_point start;
+
+public:
+    TraceScope(const char* name, long long rounds = 0) : name(name), rounds(rounds) {
+        if (tracingEnabled()) start = chrono::steady_clock::now();
+    }
+
+    ~TraceScope() {
+        if (!tracingEnabled()) return;
+        static thread_local int thread = profileTotals().nextThread++;
+        auto micros = [](chrono::steady_clock::duration d) { return chrono::duration_cast<chrono::microseconds>(d).count(); };
+        threadTrace.push_back({ name, thread, micros(start - profileTotals().origin), micros(chrono::steady_clock::now() - start), rounds });
+    }
+#else
+public:
+    TraceScope(const char*, long long = 0) {}
+#endif
+};
+
+// Moves this thread's counters and spans into the totals; called at the end of every block of rounds.
+void profileFlush() {
+#if LAB1_PROFILE
+    if (!profilingEnabled()) return;
+    ProfileTotals& totals = profileTotals();
+    lock_guard<mutex> guard(totals.lock);
+    totals.counters.merge(threadProfile);
+    threadProfile = ProfileCounters();
+    totals.spans.insert(totals.spans.end(), threadTrace.begin(), threadTrace.end());
+    threadTrace.clear();
+#endif
+}
+
+void startProfiling(bool trace) {
+    profilingEnabled() = true;
+    tracingEnabled() = trace;
+    profileTotals().origin = chrono::steady_clock::now();
+}
+
+void writeProfileReport(ostream& out) {
+    const ProfileCounters& totals = profileTotals().counters;
+    uint64_t allCycles = 0;
+    for (int i = 0; i < ProfilePhaseCount; ++i) allCycles += totals.cycles[i];
+    out << "phase            cycles          calls           cycles/call  share\n";
+    for (int i = 0; i < ProfilePhaseCount; ++i) {
+        if (totals.calls[i] == 0) continue;
+        char line[128];
+        snprintf(line, sizeof(line), "%-16s %-15llu %-15llu %-12.1f %5.1f%%\n", profilePhaseName(i),
+                 static_cast<unsigned long long>(totals.cycles[i]), static_cast<unsigned long long>(totals.calls[i]),
+                 static_cast<double>(totals.cycles[i]) / totals.calls[i], allCycles ? 100.0 * totals.cycles[i] / allCycles : 0.0);
+        out << line;
+    }
+    for (int i = 0; i < ProfileEventCount; ++i) {
+        out << profileEventName(i) << ' ' << totals.events[i] << '\n';
+    }
+}
+
+// Chrome's JSON trace format (chrome://tracing, Perfetto): one complete event per span, with the counter
+// totals under otherData.
+bool writeChromeTrace(const string& path, string& error) {
+    ProfileTotals& totals = profileTotals();
+    ofstream out(path, ios::trunc);
+    if (!out) {
+        error = "cannot write " + path;
+        return false;
+    }
+    out << "{\"traceEvents\":[";
+    for (size_t i = 0; i < totals.spans.size(); ++i) {
+        const TraceSpan& span = totals.spans[i];
+        out << (i ? ",\n" : "\n") << "{\"name\":\"" << span.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << span.thread
+            << ",\"ts\":" << span.begin << ",\"dur\":" << span.duration << ",\"args\":{\"rounds\":" << span.rounds << "}}";
+    }
+    out << "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{";
+    for (int i = 0; i < ProfilePhaseCount; ++i) {
+        out << (i ? "," : "") << "\"" << profilePhaseName(i) << "Cycles\":" << totals.counters.cycles[i];
+    }
+    for (int i = 0; i < ProfileEventCount; ++i) out << ",\"" << profileEventName(i) << "\":" << totals.counters.events[i];
+    out << "}}\n";
+    if (!out.flush()) {
+        error = "cannot write " + path;
+        return false;
+    }
+    return true;
+}
+
+// Equipment and characters own no heap memory, so an arena can free them without running destructors: names
+// point at storage that outlives them (the static equipment lists, or a string copied into the arena).
 class Equipment {
 protected:
-    string name;
+    const char* name;
 
 public:
-    Equipment(string name) : name(name) {}
-    virtual ~Equipment() {}
+    Equipment(const char* name) : name(name) {}
 
     string getName() const { return name; }
     virtual void display() const = 0;
@@ -26,7 +274,7 @@ private:
     int damageBonus;
 
 public:
-    Weapon(string name, int damageBonus)
+    Weapon(const char* name, int damageBonus)
         : Equipment(name), damageBonus(damageBonus) {}
 
     int getDamageBonus() const { return damageBonus; }
@@ -46,20 +294,28 @@ public:
 class Armor : public Equipment {
 private:
     int defenseBonus;
+    double reductionFactor;
 
 public:
-    Armor(string name, int defenseBonus)
-        : Equipment(name), defenseBonus(defenseBonus) {}
+    Armor(const char* name, int defenseBonus)
+        : Equipment(name), defenseBonus(defenseBonus), reductionFactor(1 - exp(-0.01 * defenseBonus)) {}
 
     int getDefenseBonus() const { return defenseBonus; }
 
-    int reduceDamage(int incomingDamage) const {
-        double reductionFactor = 1 - exp(-0.01 * defenseBonus);
+    double getReductionFactor() const {
+        return reductionFactor;
+    }
+
+    static int reduceDamage(int incomingDamage, double reductionFactor) {
         int reducedDamage = incomingDamage * (1.0 - reductionFactor);
         if (reducedDamage < 1) reducedDamage = 1;
         return reducedDamage;
     }
 
+    int reduceDamage(int incomingDamage) const {
+        return reduceDamage(incomingDamage, reductionFactor);
+    }
+
     void display() const override {
         cout << "Armor: " << name << ", Defense Bonus: " << defenseBonus << endl;
     }
@@ -72,24 +328,144 @@ public:
     }
 };
 
+enum class CombatEventType {
+    Attack,
+    SpellCast,
+    SpellFailed,
+    Damage,
+    Move
+};
+
+struct CombatEvent {
+    CombatEventType type;
+    int actor;
+    int target;
+    int amount;
+    int spellId;
+    int healthAfter;
+};
+
+class CombatEventSink {
+public:
+    virtual ~CombatEventSink() {}
+    virtual void onEvent(const CombatEvent& event) = 0;
+};
+
+enum class CharacterClass {
+    Warrior,
+    Archer,
+    Mage
+};
+
+// Per-class stat formulas, usable in constant expressions; the classes below only copy them into members.
+template <CharacterClass C>
+struct ClassTraits;
+
+template <>
+struct ClassTraits<CharacterClass::Warrior> {
+    static constexpr int strength(int level) { return level * 5; }
+    static constexpr int dexterity(int level) { return 5 + level; }
+    static constexpr int intelligence(int level) { return 2 + level * 2; }
+    static constexpr int health(int level) { return 40 + strength(level) * 4; }
+    static constexpr int damagePotential(int level) { return strength(level) + level * 2; }
+    static constexpr float range = 1.5f;
+};
+
+template <>
+struct ClassTraits<CharacterClass::Archer> {
+    static constexpr int strength(int level) { return 5 + level * 2; }
+    static constexpr int dexterity(int level) { return 10 + level * 5; }
+    static constexpr int intelligence(int level) { return 2 + level; }
+    static constexpr int health(int level) { return 40 + strength(level) * 4; }
+    static constexpr int damagePotential(int level) { return dexterity(level) + level * 1; }
+    static constexpr float range = 6.0f;
+};
+
+template <>
+struct ClassTraits<CharacterClass::Mage> {
+    static constexpr int strength(int level) { return 5 + level; }
+    static constexpr int dexterity(int level) { return 2 + level * 2; }
+    static constexpr int intelligence(int level) { return 10 + level * 5; }
+    static constexpr int health(int level) { return 50 + strength(level) * 4; }
+    static constexpr int damagePotential(int level) { return intelligence(level) + level * 3; }
+    static constexpr float range = 5.0f;
+};
+
+// Weapon reach in the positional mode, in formation spacings.
+inline float attackRange(CharacterClass characterClass) {
+    switch (characterClass) {
+        case CharacterClass::Warrior: return ClassTraits<CharacterClass::Warrior>::range;
+        case CharacterClass::Archer: return ClassTraits<CharacterClass::Archer>::range;
+        case CharacterClass::Mage: return ClassTraits<CharacterClass::Mage>::range;
+    }
+    return ClassTraits<CharacterClass::Warrior>::range;
+}
+
+// Shared by every class: mana scales with intelligence, spell slot 0 and 1 scale with level. A spell on
+// cooldown N cannot be cast again in its caster's next N turns.
+struct SpellTraits {
+    static constexpr int maxMana(int intelligence) { return intelligence * 2; }
+    static constexpr int damage(int level, int slot) { return slot == 0 ? level * 3 + 10 : level * 4 + 10; }
+    static constexpr int cost(int slot) { return slot == 0 ? 5 : 8; }
+    static constexpr int cooldown(int slot) { return slot == 0 ? 0 : 2; }
+};
+
+// Every class's spells in one flat table: a spell id indexes it, and class c owns the SpellsPerClass ids from
+// c * SpellsPerClass, in slot order.
+const int SpellsPerClass = 2;
+
+struct SpellDefinition {
+    const char* name;
+    int slot;
+};
+
+const SpellDefinition spellTable[] = {
+    { "Heavy Slash", 0 }, { "Smite", 1 },
+    { "Power Shot", 0 }, { "Bear Trap", 1 },
+    { "Ice Shard", 0 }, { "Fire Blast", 1 }
+};
+
+constexpr int spellIdOf(CharacterClass characterClass, int slot) {
+    return static_cast<int>(characterClass) * SpellsPerClass + slot;
+}
+
+// Which spell a unit casts once its coin flip says it tries: the class's first spell (the classic rule), the
+// most damaging one it can cast now, or a random castable one weighted by damage per mana.
+enum class SpellPolicy {
+    First,
+    Strongest,
+    Weighted
+};
+
 class Spell {
 private:
-    string name;
+    int id;
     int damage;
     int manaCost;
+    int cooldown;
 
 public:
-    Spell(string name, int damage, int manaCost)
-        : name(name), damage(damage), manaCost(manaCost) {}
+    Spell(int id, int level)
+        : id(id), damage(SpellTraits::damage(level, spellTable[id].slot)), manaCost(SpellTraits::cost(spellTable[id].slot)),
+          cooldown(SpellTraits::cooldown(spellTable[id].slot)) {}
 
-    string getName() const { return name; }
+    int getId() const { return id; }
+    const char* getName() const { return spellTable[id].name; }
     int getDamage() const { return damage; }
     int getManaCost() const { return manaCost; }
+    int getCooldown() const { return cooldown; }
 };
 
+// Highest character level anywhere (menu, scenarios, optimizer, sweeps); keeps every stat far from int overflow.
+const int MaxLevel = 100;
+
+static_assert(ClassTraits<CharacterClass::Warrior>::damagePotential(10) == 70, "warrior formula");
+static_assert(ClassTraits<CharacterClass::Mage>::health(1) == 74, "mage formula");
+
 class Character {
 protected:
-    string name;
+    const char* name;
+    int id;
     int health;
     int MaxHealth;
     int level;
@@ -100,18 +476,24 @@ protected:
     int maxMana;
     Weapon* weapon;
     Armor* armor;
-    vector<Spell> spells;
+    int spellIds[SpellsPerClass];
+    int spellCount;
 
 public:
-    Character(string name, int level, Weapon* weapon = nullptr, Armor* armor = nullptr)
-        : name(name), level(level), weapon(weapon), armor(armor), health(0), mana(0), maxMana(0) {}
-
-    virtual ~Character() {}
+    Character(const char* name, int level, Weapon* weapon = nullptr, Armor* armor = nullptr)
+        : name(name), id(-1), level(level), weapon(weapon), armor(armor), health(0), mana(0), maxMana(0), spellCount(0) {}
 
     string getName() const { return name; }
+    int getId() const { return id; }
+    void setId(int newId) { id = newId; }
     int getHealth() const { return health; }
     int getLevel() const { return level; }
     int getMana() const { return mana; }
+    int getMaxHealth() const { return MaxHealth; }
+    const Weapon* getWeapon() const { return weapon; }
+    const Armor* getArmor() const { return armor; }
+
+    virtual CharacterClass getCharacterClass() const = 0;
 
     void initializeStats() {
         setStatsByClass();
@@ -119,7 +501,8 @@ public:
 
     virtual void setStatsByClass() = 0;
 
-    string takeDamage(int damage) {
+
+    int takeDamage(int damage, CombatEventSink* sink = nullptr, int sourceId = -1) {
         int actualDamage = damage;
         if (armor) {
             actualDamage = armor->reduceDamage(damage);
@@ -127,11 +510,8 @@ public:
         health -= actualDamage;
         if (health < 0) health = 0;
 
-        string log = name + " takes " + to_string(actualDamage) + " damage. Health is now " + to_string(health) + ".";
-        if (health == 0) {
-            log += " " + name + " dies!";
-        }
-        return log;
+        if (sink) sink->onEvent({ CombatEventType::Damage, sourceId, id, actualDamage, -1, health });
+        return actualDamage;
     }
 
     bool isAlive() const {
@@ -140,12 +520,34 @@ public:
 
     virtual int getDamagePotential() const = 0;
 
-    virtual string attack(Character& target) = 0;
+    int getAttackDamage() const {
+        int damage = getDamagePotential();
+        if (weapon) {
+            damage += weapon->getDamageBonus();
+        }
+        return damage;
+    }
+
+    virtual void attack(Character& target, CombatEventSink* sink = nullptr) = 0;
 
-    virtual string castSpell(Spell& spell, Character& target) = 0;
+    bool castSpell(int slot, Character& target, CombatEventSink* sink = nullptr) {
+        Spell spell = getSpell(slot);
+        if (mana < spell.getManaCost()) {
+            if (sink) sink->onEvent({ CombatEventType::SpellFailed, id, target.id, 0, spell.getId(), target.health });
+            return false;
+        }
+        mana -= spell.getManaCost();
+        if (sink) sink->onEvent({ CombatEventType::SpellCast, id, target.id, spell.getDamage(), spell.getId(), target.health });
+        target.takeDamage(spell.getDamage(), sink, id);
+        return true;
+    }
 
-    const vector<Spell>& getAvailableSpells() const {
-        return spells;
+    int getSpellCount() const { return spellCount; }
+    Spell getSpell(int slot) const { return Spell(spellIds[slot], level); }
+
+    void learnClassSpells() {
+        for (int slot = 0; slot < SpellsPerClass; ++slot) spellIds[slot] = spellIdOf(getCharacterClass(), slot);
+        spellCount = SpellsPerClass;
     }
 
     void resetHealth() {
@@ -170,101 +572,62 @@ public:
 };
 
 class Warrior : public Character {
-private:
-    Spell* heavySlash;
-    Spell* smite;
-
 public:
-    Warrior(string name, int level, Weapon* weapon = nullptr, Armor* armor = nullptr)
+    Warrior(const char* name, int level, Weapon* weapon = nullptr, Armor* armor = nullptr)
         : Character(name, level, weapon, armor) {
         initializeStats();
-        heavySlash = new Spell("Heavy Slash", level * 3 + 10, 5); 
-        smite = new Spell("Smite", level * 4 + 10, 8);
-        spells.push_back(*heavySlash);
-        spells.push_back(*smite);
+        learnClassSpells();
     }
 
     void setStatsByClass() override {
-        strength = level * 5;
-        dexterity = 5 + level;
-        intelligence = 2 + level * 2;
-        health = 40 + strength * 4;
+        typedef ClassTraits<CharacterClass::Warrior> Traits;
+        strength = Traits::strength(level);
+        dexterity = Traits::dexterity(level);
+        intelligence = Traits::intelligence(level);
+        health = Traits::health(level);
         MaxHealth = health;
-        maxMana = intelligence * 2;
+        maxMana = SpellTraits::maxMana(intelligence);
         mana = maxMana;
     }
 
-    string attack(Character& target) override {
-        int damage = strength + (level * 2);
-        if (weapon) {
-            damage += weapon->getDamageBonus();
-        }
-        target.takeDamage(damage);
-        return name + " swings a sword at " + target.getName() + ", dealing " + to_string(damage) + " damage!";
-    }
-
-    string castSpell(Spell& spell, Character& target) override {
-        if (mana >= spell.getManaCost()) {
-            mana -= spell.getManaCost();
-            target.takeDamage(spell.getDamage());
-            return name + " casts " + spell.getName() + " on " + target.getName() + ", dealing " + to_string(spell.getDamage()) + " damage!";
-        } else {
-            return name + " doesn't have enough mana to cast " + spell.getName() + "!";
-        }
+    void attack(Character& target, CombatEventSink* sink = nullptr) override {
+        int damage = getAttackDamage();
+        if (sink) sink->onEvent({ CombatEventType::Attack, id, target.getId(), damage, -1, target.getHealth() });
+        target.takeDamage(damage, sink, id);
     }
 
     int getDamagePotential() const override {
-        return strength + (level * 2);
+        return ClassTraits<CharacterClass::Warrior>::damagePotential(level);
     }
 
-    ~Warrior() {
-        delete heavySlash;
-        delete smite;
+    CharacterClass getCharacterClass() const override {
+        return CharacterClass::Warrior;
     }
 };
 
 class Archer : public Character {
-private:
-    Spell* powerShot;
-    Spell* bearTrap;
-
 public:
-    Archer(string name, int level, Weapon* weapon = nullptr, Armor* armor = nullptr)
+    Archer(const char* name, int level, Weapon* weapon = nullptr, Armor* armor = nullptr)
         : Character(name, level, weapon, armor) {
         initializeStats();
-        powerShot = new Spell("Power Shot", level * 3 + 10, 5);
-        bearTrap = new Spell("Bear Trap", level * 4 + 10, 8);
-        spells.push_back(*powerShot);
-        spells.push_back(*bearTrap);
+        learnClassSpells();
     }
 
     void setStatsByClass() override {
-        strength = 5 + level * 2;        
-        dexterity = 10 + level * 5; 
-        intelligence = 2 + level;    
-        health = 40 + (strength * 4);
+        typedef ClassTraits<CharacterClass::Archer> Traits;
+        strength = Traits::strength(level);
+        dexterity = Traits::dexterity(level);
+        intelligence = Traits::intelligence(level);
+        health = Traits::health(level);
         MaxHealth = health;
-        maxMana = intelligence * 2;
+        maxMana = SpellTraits::maxMana(intelligence);
         mana = maxMana;
     }
 
-    string attack(Character& target) override {
-        int damage = dexterity + (level * 1);
-        if (weapon) {
-            damage += weapon->getDamageBonus();
-        }
-        target.takeDamage(damage);
-        return name + " shoots an arrow at " + target.getName() + ", dealing " + to_string(damage) + " damage!";
-    }
-
-    string castSpell(Spell& spell, Character& target) override {
-        if (mana >= spell.getManaCost()) {
-            mana -= spell.getManaCost();
-            target.takeDamage(spell.getDamage());
-        return name + " casts " + spell.getName() + " on " + target.getName() + ", dealing " + to_string(spell.getDamage()) + " damage!";
-        } else {
-            return name + " doesn't have enough mana to cast " + spell.getName() + "!";
-        }
+    void attack(Character& target, CombatEventSink* sink = nullptr) override {
+        int damage = getAttackDamage();
+        if (sink) sink->onEvent({ CombatEventType::Attack, id, target.getId(), damage, -1, target.getHealth() });
+        target.takeDamage(damage, sink, id);
     }
 
     void display() const override {
@@ -273,57 +636,37 @@ public:
     }
 
     int getDamagePotential() const override {
-        return dexterity + (level * 1);
+        return ClassTraits<CharacterClass::Archer>::damagePotential(level);
     }
 
-    ~Archer() {
-        delete powerShot;
-        delete bearTrap;
+    CharacterClass getCharacterClass() const override {
+        return CharacterClass::Archer;
     }
 };
 
 class Mage : public Character {
-private:
-    Spell* iceShard;
-    Spell* fireBlast;
-
 public:
-    Mage(string name, int level, Weapon* weapon = nullptr, Armor* armor = nullptr)
+    Mage(const char* name, int level, Weapon* weapon = nullptr, Armor* armor = nullptr)
         : Character(name, level, weapon, armor) {
         initializeStats();
-        iceShard = new Spell("Ice Shard", level * 3 + 10, 5);
-        fireBlast = new Spell("Fire Blast", level * 4 + 10, 8);
-        spells.push_back(*iceShard);
-        spells.push_back(*fireBlast);
+        learnClassSpells();
     }
 
     void setStatsByClass() override {
-        strength = 5 + level; 
-        dexterity = 2 + level * 2;    
-        intelligence = 10 + level * 5; 
-        health = 50 + strength * 4; 
+        typedef ClassTraits<CharacterClass::Mage> Traits;
+        strength = Traits::strength(level);
+        dexterity = Traits::dexterity(level);
+        intelligence = Traits::intelligence(level);
+        health = Traits::health(level);
         MaxHealth = health;
-        maxMana = intelligence * 2;
+        maxMana = SpellTraits::maxMana(intelligence);
         mana = maxMana;
     }
 
-    string attack(Character& target) override {
-        int damage = intelligence + (level * 3);
-        if (weapon) {
-            damage += weapon->getDamageBonus(); 
-        }
-        target.takeDamage(damage);
-        return name + " shoots a firebolt at " + target.getName() + ", dealing " + to_string(damage) + " damage!";
-    }
-
-    string castSpell(Spell& spell, Character& target) override {
-        if (mana >= spell.getManaCost()) {
-            mana -= spell.getManaCost();
-            target.takeDamage(spell.getDamage());
-        return name + " casts " + spell.getName() + " on " + target.getName() + ", dealing " + to_string(spell.getDamage()) + " damage!";
-        } else {
-            return name + " doesn't have enough mana to cast " + spell.getName() + "!";
-        }
+    void attack(Character& target, CombatEventSink* sink = nullptr) override {
+        int damage = getAttackDamage();
+        if (sink) sink->onEvent({ CombatEventType::Attack, id, target.getId(), damage, -1, target.getHealth() });
+        target.takeDamage(damage, sink, id);
     }
 
     void display() const override {
@@ -333,15 +676,19 @@ public:
 
     
     int getDamagePotential() const override {
-        return intelligence + (level * 3);
+        return ClassTraits<CharacterClass::Mage>::damagePotential(level);
     }
 
-    ~Mage() {
-        delete iceShard;
-        delete fireBlast;
+    CharacterClass getCharacterClass() const override {
+        return CharacterClass::Mage;
     }
 };
 
+static_assert(is_trivially_destructible<Warrior>::value && is_trivially_destructible<Archer>::value &&
+                  is_trivially_destructible<Mage>::value && is_trivially_destructible<Weapon>::value &&
+                  is_trivially_destructible<Armor>::value,
+              "arena-built units and equipment must not need destructors");
+
 int getValidatedInput(const string& prompt, int minRange, int maxRange) {
     int value;
     while (true) {
@@ -359,7 +706,90 @@ int getValidatedInput(const string& prompt, int minRange, int maxRange) {
     }
 }
 
-Character* createCharacter() {
+// Owns every character and piece of equipment of one battle setup. Objects are constructed into
+// large blocks and destroyed together, so a whole roster costs a few allocations and one release.
+class BattleArena {
+private:
+    static constexpr size_t BlockSize = 64 * 1024;
+
+    vector<char*> blocks;
+    char* cursor = nullptr;
+    size_t remaining = 0;
+    vector<pair<void*, void (*)(void*)>> destructors;
+
+    void* allocate(size_t size, size_t alignment) {
+        size_t padding = cursor ? (alignment - reinterpret_cast<uintptr_t>(cursor) % alignment) % alignment : 0;
+        if (!cursor || padding + size > remaining) {
+            size_t blockSize = max(BlockSize, size + alignment);
+            cursor = static_cast<char*>(::operator new(blockSize));
+            blocks.push_back(cursor);
+            remaining = blockSize;
+            padding = (alignment - reinterpret_cast<uintptr_t>(cursor) % alignment) % alignment;
+        }
+        void* result = cursor + padding;
+        cursor += padding + size;
+        remaining -= padding + size;
+        return result;
+    }
+
+public:
+    BattleArena() {}
+    BattleArena(const BattleArena&) = delete;
+    BattleArena& operator=(const BattleArena&) = delete;
+
+    ~BattleArena() {
+        release();
+    }
+
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (!is_trivially_destructible<T>::value) {
+            destructors.push_back({ object, [](void* p) { static_cast<T*>(p)->~T(); } });
+        }
+        return object;
+    }
+
+    void reserve(size_t objects) {
+        destructors.reserve(objects);
+    }
+
+    // A copy of `text` that lives as long as the arena, for names.
+    const char* copyString(const string& text) {
+        char* copy = static_cast<char*>(allocate(text.size() + 1, 1));
+        memcpy(copy, text.c_str(), text.size() + 1);
+        return copy;
+    }
+
+    void release() {
+        for (auto it = destructors.rbegin(); it != destructors.rend(); ++it) {
+            it->second(it->first);
+        }
+        destructors.clear();
+        for (char* block : blocks) {
+            ::operator delete(block);
+        }
+        blocks.clear();
+        cursor = nullptr;
+        remaining = 0;
+    }
+};
+
+Character* createCharacterOfClass(BattleArena& arena, CharacterClass characterClass, const string& name, int level,
+                                  Weapon* weapon, Armor* armor) {
+    const char* storedName = arena.copyString(name);
+    switch (characterClass) {
+    case CharacterClass::Warrior:
+        return arena.create<Warrior>(storedName, level, weapon, armor);
+    case CharacterClass::Archer:
+        return arena.create<Archer>(storedName, level, weapon, armor);
+    case CharacterClass::Mage:
+        return arena.create<Mage>(storedName, level, weapon, armor);
+    }
+    return nullptr;
+}
+
+Character* createCharacter(BattleArena& arena) {
     string name;
     int classChoice, level;
 
@@ -367,14 +797,14 @@ Character* createCharacter() {
     cin >> name;
 
     classChoice = getValidatedInput("Choose character class (1: Warrior, 2: Mage, 3: Archer): ", 1, 3);
-    level = getValidatedInput("Enter character level: ", 1, 100);
+    level = getValidatedInput("Enter character level: ", 1, MaxLevel);
 
     Weapon* weapon = nullptr;
     int addWeapon = getValidatedInput("Do you want to add a weapon? (1 for Yes, 0 for No): ", 0, 1);
     if (addWeapon == 1) {
         const auto& weaponList = Weapon::getWeaponList();
         int randomIndex = rand() % weaponList.size();
-        weapon = new Weapon(weaponList[randomIndex].first, weaponList[randomIndex].second);
+        weapon = arena.create<Weapon>(weaponList[randomIndex].first.c_str(), weaponList[randomIndex].second);
         cout << "Assigned weapon: " << weaponList[randomIndex].first << " (Damage Bonus: " << weaponList[randomIndex].second << ")\n";
     }
 
@@ -383,24 +813,12 @@ Character* createCharacter() {
     if (addArmor == 1) {
         const auto& armorList = Armor::getArmorList();
         int randomIndex = rand() % armorList.size();
-        armor = new Armor(armorList[randomIndex].first, armorList[randomIndex].second);
+        armor = arena.create<Armor>(armorList[randomIndex].first.c_str(), armorList[randomIndex].second);
         cout << "Assigned armor: " << armorList[randomIndex].first << " (Defense Bonus: " << armorList[randomIndex].second << ")\n";
     }
 
-    Character* character = nullptr;
-    switch (classChoice) {
-    case 1:
-        character = new Warrior(name, level, weapon, armor);
-        break;
-    case 2:
-        character = new Mage(name, level, weapon, armor);
-        break;
-    case 3:
-        character = new Archer(name, level, weapon, armor);
-        break;
-    }
-
-    return character;
+    const CharacterClass menuClasses[] = { CharacterClass::Warrior, CharacterClass::Mage, CharacterClass::Archer };
+    return createCharacterOfClass(arena, menuClasses[classChoice - 1], name, level, weapon, armor);
 }
 
 enum class FocusStrategy {
@@ -410,285 +828,5427 @@ enum class FocusStrategy {
     HighestDamage
 };
 
-Character* findTarget(Character* attacker, const vector<Character*>& enemies, FocusStrategy strategy) {
+int findTargetPosition(Character* attacker, const vector<Character*>& enemies, FocusStrategy strategy) {
     Character* target = nullptr;
-    for (Character* enemy : enemies) {
+    int position = -1;
+    int comparisons = 0;
+    for (int i = 0; i < static_cast<int>(enemies.size()); ++i) {
+        Character* enemy = enemies[i];
         if (!enemy->isAlive()) continue;
 
         if (!target) {
             target = enemy;
+            position = i;
             continue;
         }
+        comparisons++;
 
         switch (strategy) {
             case FocusStrategy::LowestHP:
                 if (enemy->getHealth() < target->getHealth()) {
                     target = enemy;
+                    position = i;
                 }
                 break;
             case FocusStrategy::HighestHP:
                 if (enemy->getHealth() > target->getHealth()) {
                     target = enemy;
+                    position = i;
                 }
                 break;
             case FocusStrategy::LowestDamage:
                 if (enemy->getDamagePotential() < target->getDamagePotential()) {
                     target = enemy;
+                    position = i;
                 }
                 break;
             case FocusStrategy::HighestDamage:
                 if (enemy->getDamagePotential() > target->getDamagePotential()) {
                     target = enemy;
+                    position = i;
                 }
                 break;
         }
     }
-    return target;
+    profileCount(ProfileEvent::TargetScans);
+    profileCount(ProfileEvent::TargetComparisons, comparisons);
+    return position;
 }
 
-class BattleGraph {
+Character* findTarget(Character* attacker, const vector<Character*>& enemies, FocusStrategy strategy) {
+    int target = findTargetPosition(attacker, enemies, strategy);
+    return target < 0 ? nullptr : enemies[target];
+}
+
+// Open-addressing map from a packed (from, to) edge key to the edge's slot in the edge list.
+// clear() keeps the capacity, so a graph rebuilt every round stops allocating after the first one.
+class EdgeSlotTable {
 private:
-    map<Character*, vector<Character*>> adjList;
+    static constexpr uint64_t EmptyKey = ~0ULL;
+    static constexpr uint64_t DeletedKey = ~0ULL - 1;
 
-public:
-    void addCharacter(Character* character) {
-        adjList[character] = vector<Character*>();
+    vector<uint64_t> keys;
+    vector<int> values;
+    size_t used = 0;
+
+    size_t slotOf(uint64_t key) const {
+        uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+        return static_cast<size_t>(h >> 20) & (keys.size() - 1);
     }
 
-    void addEdge(Character* c1, Character* c2) {
-        adjList[c1].push_back(c2);
+    void grow() {
+        vector<uint64_t> oldKeys;
+        vector<int> oldValues;
+        oldKeys.swap(keys);
+        oldValues.swap(values);
+        keys.assign(max<size_t>(16, oldKeys.size() * 2), EmptyKey);
+        values.assign(keys.size(), -1);
+        used = 0;
+        for (size_t i = 0; i < oldKeys.size(); ++i) {
+            if (oldKeys[i] != EmptyKey && oldKeys[i] != DeletedKey) insert(oldKeys[i], oldValues[i]);
+        }
     }
 
-    void createEdgesBasedOnCriteria(vector<Character*>& group1, vector<Character*>& group2, FocusStrategy strategy) {
-        adjList.clear();
+public:
+    static uint64_t key(int from, int to) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(from)) << 32) | static_cast<uint32_t>(to);
+    }
 
-        for (Character* c1 : group1) {
-            Character* target = findTarget(c1, group2, strategy);
-            if (target) {
-                addEdge(c1, target);
-            }
+    void clear() {
+        fill(keys.begin(), keys.end(), EmptyKey);
+        used = 0;
+    }
+
+    int find(uint64_t k) const {
+        if (keys.empty()) return -1;
+        for (size_t slot = slotOf(k);; slot = (slot + 1) & (keys.size() - 1)) {
+            if (keys[slot] == k) return values[slot];
+            if (keys[slot] == EmptyKey) return -1;
         }
+    }
 
-        for (Character* c2 : group2) {
-            Character* target = findTarget(c2, group1, strategy);
-            if (target) {
-                addEdge(c2, target);
+    void insert(uint64_t k, int value) {
+        if ((used + 1) * 2 > keys.size()) grow();
+        size_t target = keys.size();
+        size_t slot = slotOf(k);
+        for (;; slot = (slot + 1) & (keys.size() - 1)) {
+            if (keys[slot] == k) {
+                values[slot] = value;
+                return;
             }
+            if (keys[slot] == DeletedKey && target == keys.size()) target = slot;
+            if (keys[slot] == EmptyKey) break;
         }
+        if (target == keys.size()) {
+            target = slot;
+            used++;
+        }
+        keys[target] = k;
+        values[target] = value;
     }
 
-    void displayGraph() const {
-        cout << "Focus targets for this round:" << endl;
-        for (const auto& pair : adjList) {
-            cout << pair.first->getName() << " focuses on: ";
-            if (pair.second.empty()) {
-                cout << "No target";
-            } else {
-                for (Character* target : pair.second) {
-                    cout << target->getName() << " ";
-                }
+    void erase(uint64_t k) {
+        if (keys.empty()) return;
+        for (size_t slot = slotOf(k);; slot = (slot + 1) & (keys.size() - 1)) {
+            if (keys[slot] == k) {
+                keys[slot] = DeletedKey;
+                return;
             }
-            cout << endl;
+            if (keys[slot] == EmptyKey) return;
         }
     }
 };
 
-void battleSimulation(BattleGraph& graph, vector<Character*>& group1, vector<Character*>& group2, FocusStrategy strategy, int rounds, bool showLog) {
-    int group1Wins = 0;
-    int group2Wins = 0;
+class DisjointSets {
+private:
+    vector<int> parent;
+    vector<int> rank;
 
-    srand(static_cast<unsigned>(time(0)));
+public:
+    explicit DisjointSets(int count) : parent(count), rank(count, 0) {
+        for (int i = 0; i < count; ++i) parent[i] = i;
+    }
 
-    for (int i = 0; i < rounds; ++i) {
-        if (showLog) {
-            cout << "\nRound " << i + 1 << " - Target Focus:" << endl;
+    int find(int x) {
+        while (parent[x] != x) {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
         }
+        return x;
+    }
 
-        graph.createEdgesBasedOnCriteria(group1, group2, strategy);
+    bool unite(int a, int b) {
+        a = find(a);
+        b = find(b);
+        if (a == b) return false;
+        if (rank[a] < rank[b]) swap(a, b);
+        parent[b] = a;
+        if (rank[a] == rank[b]) rank[a]++;
+        return true;
+    }
+};
 
-        if (showLog) {
-            graph.displayGraph();
+// Binary min-heap over vertex ids with decrease-key, so Prim keeps at most one entry per vertex.
+class IndexedMinHeap {
+private:
+    vector<int> heap;
+    vector<int> position;
+    vector<long long> keys;
+
+    void swapNodes(int a, int b) {
+        swap(heap[a], heap[b]);
+        position[heap[a]] = a;
+        position[heap[b]] = b;
+    }
+
+    void siftUp(int i) {
+        while (i > 0 && keys[heap[(i - 1) / 2]] > keys[heap[i]]) {
+            swapNodes(i, (i - 1) / 2);
+            i = (i - 1) / 2;
         }
+    }
+
+    void siftDown(int i) {
+        int n = static_cast<int>(heap.size());
+        while (true) {
+            int smallest = i;
+            int left = 2 * i + 1, right = 2 * i + 2;
+            if (left < n && keys[heap[left]] < keys[heap[smallest]]) smallest = left;
+            if (right < n && keys[heap[right]] < keys[heap[smallest]]) smallest = right;
+            if (smallest == i) return;
+            swapNodes(i, smallest);
+            i = smallest;
+        }
+    }
 
-        for (Character* c : group1) c->resetHealth();
-        for (Character* c : group2) c->resetHealth();
+public:
+    explicit IndexedMinHeap(int capacity) : position(capacity, -1), keys(capacity, 0) {}
 
-        bool roundOver = false;
+    bool empty() const { return heap.empty(); }
+    bool contains(int id) const { return position[id] >= 0; }
+    long long key(int id) const { return keys[id]; }
 
-        while (!roundOver) {
-            for (Character* attacker : group1) {
-                if (!attacker || !attacker->isAlive()) continue;
+    void pushOrDecrease(int id, long long key) {
+        if (position[id] < 0) {
+            keys[id] = key;
+            position[id] = static_cast<int>(heap.size());
+            heap.push_back(id);
+            siftUp(position[id]);
+        } else if (key < keys[id]) {
+            keys[id] = key;
+            siftUp(position[id]);
+        }
+    }
 
-                Character* defender = findTarget(attacker, group2, strategy);
-                if (!defender) {
-                    group1Wins++;
-                    roundOver = true;
-                    break;
-                }
+    int pop() {
+        int top = heap[0];
+        swapNodes(0, static_cast<int>(heap.size()) - 1);
+        heap.pop_back();
+        position[top] = -1;
+        if (!heap.empty()) siftDown(0);
+        return top;
+    }
+};
 
-                string attackLog = attacker->attack(*defender);
-                if (showLog) cout << attackLog << endl;
+struct SpanningTree {
+    vector<int> from;
+    vector<int> to;
+    vector<int> weight;
+    long long totalWeight = 0;
+    int components = 0;
+};
 
-                string damageLog = defender->takeDamage(attacker->getDamagePotential());
-                if (showLog) cout << damageLog << endl;
+// Vertices are dense ids (group1 first, then group2, like CombatState). Edges live in a flat edge
+// list with an O(1) lookup table; the CSR view used for traversal is rebuilt lazily after changes.
+class BattleGraph {
+private:
+    vector<Character*> vertices;
+    vector<int> edgeFrom;
+    vector<int> edgeTo;
+    vector<int> edgeWeight;
+    EdgeSlotTable edgeSlots;
 
-                if (!defender->isAlive()) continue;
+    mutable vector<int> offsets;
+    mutable vector<int> adjacency;
+    mutable vector<int> adjacencyCursor;
+    mutable bool csrDirty = true;
 
-                if (!attacker->getAvailableSpells().empty() && rand() % 2 == 0) {
-                    Spell spell = Spell(attacker->getAvailableSpells().front());
-                    if (attacker->getMana() >= spell.getManaCost()) {
-                        string spellLog = attacker->castSpell(spell, *defender);
-                        if (showLog) cout << spellLog << endl;
+    // Union-find roots of the undirected graph, kept until the edges or vertices change.
+    mutable vector<int> componentRoot;
+    mutable bool componentsDirty = true;
 
-                        damageLog = defender->takeDamage(spell.getDamage());
-                        if (showLog) cout << damageLog << endl;
-                    }
-                }
-            }
+    void rebuildCsr() const {
+        if (!csrDirty) return;
+        offsets.assign(vertices.size() + 1, 0);
+        for (int from : edgeFrom) offsets[from + 1]++;
+        for (size_t v = 0; v < vertices.size(); ++v) offsets[v + 1] += offsets[v];
+        adjacency.resize(edgeFrom.size());
+        adjacencyCursor.assign(offsets.begin(), offsets.end() - 1);
+        for (size_t e = 0; e < edgeFrom.size(); ++e) {
+            adjacency[adjacencyCursor[edgeFrom[e]]++] = edgeTo[e];
+        }
+        csrDirty = false;
+    }
 
-            if (roundOver) break;
+    void rebuildComponents() const {
+        if (!componentsDirty) return;
+        DisjointSets sets(vertexCount());
+        for (size_t e = 0; e < edgeFrom.size(); ++e) sets.unite(edgeFrom[e], edgeTo[e]);
+        componentRoot.assign(vertexCount(), -1);
+        for (int v = 0; v < vertexCount(); ++v) {
+            if (vertices[v]) componentRoot[v] = sets.find(v);
+        }
+        componentsDirty = false;
+    }
 
-            for (Character* attacker : group2) {
-                if (!attacker || !attacker->isAlive()) continue;
+public:
+    int vertexCount() const { return static_cast<int>(vertices.size()); }
+    int edgeCount() const { return static_cast<int>(edgeFrom.size()); }
+    Character* getCharacter(int vertex) const { return vertices[vertex]; }
+    bool hasVertex(int vertex) const { return vertex >= 0 && vertex < vertexCount() && vertices[vertex]; }
 
-                Character* defender = findTarget(attacker, group1, strategy);
-                if (!defender) {
-                    group2Wins++;
-                    roundOver = true;
-                    break;
-                }
+    void clear() {
+        vertices.clear();
+        edgeFrom.clear();
+        edgeTo.clear();
+        edgeWeight.clear();
+        edgeSlots.clear();
+        csrDirty = true;
+        componentsDirty = true;
+    }
 
-                string attackLog = attacker->attack(*defender);
-                if (showLog) cout << attackLog << endl;
+    int addCharacter(Character* character) {
+        vertices.push_back(character);
+        csrDirty = true;
+        componentsDirty = true;
+        return vertexCount() - 1;
+    }
 
-                string damageLog = defender->takeDamage(attacker->getDamagePotential());
-                if (showLog) cout << damageLog << endl;
+    bool hasEdge(int from, int to) const {
+        return edgeSlots.find(EdgeSlotTable::key(from, to)) >= 0;
+    }
 
-                if (!defender->isAlive()) continue;
+    bool addEdge(int from, int to, int weight = 0) {
+        if (!hasVertex(from) || !hasVertex(to) || hasEdge(from, to)) return false;
+        edgeSlots.insert(EdgeSlotTable::key(from, to), edgeCount());
+        edgeFrom.push_back(from);
+        edgeTo.push_back(to);
+        edgeWeight.push_back(weight);
+        csrDirty = true;
+        componentsDirty = true;
+        return true;
+    }
 
-                if (!attacker->getAvailableSpells().empty() && rand() % 2 == 0) {
-                    Spell spell = Spell(attacker->getAvailableSpells().front());
-                    if (attacker->getMana() >= spell.getManaCost()) {
-                        string spellLog = attacker->castSpell(spell, *defender);
-                        if (showLog) cout << spellLog << endl;
+    bool removeEdge(int from, int to) {
+        uint64_t k = EdgeSlotTable::key(from, to);
+        int slot = edgeSlots.find(k);
+        if (slot < 0) return false;
 
-                        damageLog = defender->takeDamage(spell.getDamage());
-                        if (showLog) cout << damageLog << endl;
-                    }
-                }
-            }
+        int last = edgeCount() - 1;
+        if (slot != last) {
+            edgeFrom[slot] = edgeFrom[last];
+            edgeTo[slot] = edgeTo[last];
+            edgeWeight[slot] = edgeWeight[last];
+            edgeSlots.insert(EdgeSlotTable::key(edgeFrom[slot], edgeTo[slot]), slot);
         }
+        edgeFrom.pop_back();
+        edgeTo.pop_back();
+        edgeWeight.pop_back();
+        edgeSlots.erase(k);
+        csrDirty = true;
+        componentsDirty = true;
+        return true;
     }
 
-    cout << "\nResults after " << rounds << " rounds:\n";
-    cout << "Group 1 won: " << group1Wins << " time(s).\n";
-    cout << "Group 2 won: " << group2Wins << " time(s).\n";
-    double probGroup1Win = static_cast<double>(group1Wins) / rounds * 100;
-    double probGroup2Win = static_cast<double>(group2Wins) / rounds * 100;
-    cout << "Group 1 win probability: " << probGroup1Win << "%\n";
-    cout << "Group 2 win probability: " << probGroup2Win << "%\n";
-}
+    // The id stays reserved so other vertex ids do not shift.
+    bool removeCharacter(int vertex) {
+        if (!hasVertex(vertex)) return false;
+        for (int e = edgeCount() - 1; e >= 0; --e) {
+            if (edgeFrom[e] == vertex || edgeTo[e] == vertex) removeEdge(edgeFrom[e], edgeTo[e]);
+        }
+        vertices[vertex] = nullptr;
+        csrDirty = true;
+        componentsDirty = true;
+        return true;
+    }
 
-FocusStrategy chooseFocusStrategy() {
-    cout << "Choose criteria for characters to foccus their attck on:\n";
-    cout << "1. Least HP\n";
-    cout << "2. Most HP\n";
-    cout << "3. least Damage\n";
-    cout << "4. Most Damage\n";
-    int choice;
-    cin >> choice;
-    switch (choice) {
-        case 1: return FocusStrategy::LowestHP;
-        case 2: return FocusStrategy::HighestHP;
-        case 3: return FocusStrategy::LowestDamage;
-        case 4: return FocusStrategy::HighestDamage;
-        default: 
-            cout << "Invalid choice. Retutned to default (lowest HP)\n";
-            return FocusStrategy::LowestHP;
+    int getEdgeWeight(int from, int to) const {
+        int slot = edgeSlots.find(EdgeSlotTable::key(from, to));
+        return slot < 0 ? 0 : edgeWeight[slot];
     }
-}
 
-void mainMenu() {
+    const int* neighbours(int vertex, int& count) const {
+        rebuildCsr();
+        count = offsets[vertex + 1] - offsets[vertex];
+        return adjacency.data() + offsets[vertex];
+    }
+
+    void createEdgesBasedOnCriteria(vector<Character*>& group1, vector<Character*>& group2, FocusStrategy strategy) {
+        ProfileLap lap;
+        clear();
+        for (Character* c : group1) addCharacter(c);
+        for (Character* c : group2) addCharacter(c);
+
+        const int group1Size = static_cast<int>(group1.size());
+        for (int i = 0; i < group1Size; ++i) {
+            int target = findTargetPosition(group1[i], group2, strategy);
+            if (target >= 0) {
+                addEdge(i, group1Size + target, group1[i]->getDamagePotential());
+            }
+        }
+
+        for (int i = 0; i < static_cast<int>(group2.size()); ++i) {
+            int target = findTargetPosition(group2[i], group1, strategy);
+            if (target >= 0) {
+                addEdge(group1Size + i, target, group2[i]->getDamagePotential());
+            }
+        }
+        lap.mark(ProfilePhase::GraphRebuild);
+    }
+
+    // Spanning trees and components treat every focus edge as undirected. Disconnected graphs
+    // give a spanning forest with one tree per component.
+    SpanningTree kruskalSpanningTree(bool maximum) const {
+        // Sort packed (order-preserving weight, edge) keys instead of comparing through an index array.
+        vector<uint64_t> order(edgeFrom.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            uint32_t key = static_cast<uint32_t>(edgeWeight[i]) ^ 0x80000000u;
+            if (maximum) key = ~key;
+            order[i] = (static_cast<uint64_t>(key) << 32) | i;
+        }
+        sort(order.begin(), order.end());
+
+        SpanningTree tree;
+        DisjointSets sets(vertexCount());
+        for (uint64_t packed : order) {
+            int e = static_cast<int>(packed & 0xFFFFFFFFu);
+            if (sets.unite(edgeFrom[e], edgeTo[e])) {
+                tree.from.push_back(edgeFrom[e]);
+                tree.to.push_back(edgeTo[e]);
+                tree.weight.push_back(edgeWeight[e]);
+                tree.totalWeight += edgeWeight[e];
+            }
+        }
+        tree.components = liveVertexCount() - static_cast<int>(tree.from.size());
+        return tree;
+    }
+
+    SpanningTree primSpanningTree(bool maximum) const {
+        const int n = vertexCount();
+        vector<int> start(n + 1, 0);
+        for (size_t e = 0; e < edgeFrom.size(); ++e) {
+            start[edgeFrom[e] + 1]++;
+            start[edgeTo[e] + 1]++;
+        }
+        for (int v = 0; v < n; ++v) start[v + 1] += start[v];
+        vector<int> next(start.begin(), start.end() - 1);
+        vector<int> incident(2 * edgeFrom.size());
+        for (size_t e = 0; e < edgeFrom.size(); ++e) {
+            incident[next[edgeFrom[e]]++] = static_cast<int>(e);
+            incident[next[edgeTo[e]]++] = static_cast<int>(e);
+        }
+
+        // Each vertex outside the tree keeps its cheapest connecting edge; a maximum tree negates the weights.
+        IndexedMinHeap heap(n);
+        vector<int> bestEdge(n, -1);
+        vector<unsigned char> inTree(n, 0);
+        SpanningTree tree;
+
+        for (int root = 0; root < n; ++root) {
+            if (!vertices[root] || inTree[root]) continue;
+            tree.components++;
+            heap.pushOrDecrease(root, 0);
+
+            while (!heap.empty()) {
+                int v = heap.pop();
+                inTree[v] = 1;
+                int e = bestEdge[v];
+                if (e >= 0) {
+                    tree.from.push_back(edgeFrom[e]);
+                    tree.to.push_back(edgeTo[e]);
+                    tree.weight.push_back(edgeWeight[e]);
+                    tree.totalWeight += edgeWeight[e];
+                }
+
+                for (int i = start[v]; i < start[v + 1]; ++i) {
+                    int edge = incident[i];
+                    int other = edgeFrom[edge] == v ? edgeTo[edge] : edgeFrom[edge];
+                    if (inTree[other]) continue;
+                    long long key = maximum ? -static_cast<long long>(edgeWeight[edge]) : edgeWeight[edge];
+                    if (!heap.contains(other) || key < heap.key(other)) {
+                        heap.pushOrDecrease(other, key);
+                        bestEdge[other] = edge;
+                    }
+                }
+            }
+        }
+        return tree;
+    }
+
+    int liveVertexCount() const {
+        int count = 0;
+        for (Character* c : vertices) {
+            if (c) count++;
+        }
+        return count;
+    }
+
+    // Fills componentOf with a representative vertex per component (-1 for removed vertices).
+    int connectedComponents(vector<int>& componentOf) const {
+        rebuildComponents();
+        componentOf = componentRoot;
+        int count = 0;
+        for (int v = 0; v < vertexCount(); ++v) {
+            if (componentOf[v] == v) count++;
+        }
+        return count;
+    }
+
+    // One union-find pass per change to the graph; queries in between are O(1).
+    bool sameComponent(int a, int b) const {
+        if (!hasVertex(a) || !hasVertex(b)) return false;
+        rebuildComponents();
+        return componentRoot[a] == componentRoot[b];
+    }
+
+    void displaySpanningTree(bool maximum) const {
+        SpanningTree tree = kruskalSpanningTree(maximum);
+        cout << (maximum ? "Maximum" : "Minimum") << " threat spanning tree (" << tree.components
+             << " component(s), total threat " << tree.totalWeight << "):" << endl;
+        for (size_t i = 0; i < tree.from.size(); ++i) {
+            cout << vertices[tree.from[i]]->getName() << " -> " << vertices[tree.to[i]]->getName()
+                 << " (threat " << tree.weight[i] << ")" << endl;
+        }
+    }
+
+    void displayGraph() const {
+        cout << "Focus targets for this round:" << endl;
+        for (int v = 0; v < vertexCount(); ++v) {
+            if (!vertices[v]) continue;
+            int count = 0;
+            const int* targets = neighbours(v, count);
+            cout << vertices[v]->getName() << " focuses on: ";
+            if (count == 0) {
+                cout << "No target";
+            } else {
+                for (int i = 0; i < count; ++i) {
+                    cout << vertices[targets[i]]->getName() << " ";
+                }
+            }
+            cout << endl;
+        }
+    }
+};
+
+// Tournament tree over the units of one side. The root holds the unit the enemy strategy would pick,
+// with ties going to the lower index exactly like the linear findTarget scan.
+class TargetIndex {
+private:
+    int first = 0;
+    int count = 0;
+    int leafCount = 1;
+    int depth = 0;
+    bool byHealth = true;
+    bool preferHigher = false;
+    vector<int> tree;
+
+    template <bool PreferHigher>
+    static int betterOf(const vector<int>& keys, int left, int right) {
+        if (left < 0) return right;
+        if (right < 0) return left;
+        if (PreferHigher) return keys[right] > keys[left] ? right : left;
+        return keys[right] < keys[left] ? right : left;
+    }
+
+    int better(const vector<int>& keys, int left, int right) const {
+        return preferHigher ? betterOf<true>(keys, left, right) : betterOf<false>(keys, left, right);
+    }
+
+public:
+    void init(int firstUnit, int unitCount, FocusStrategy strategy) {
+        first = firstUnit;
+        count = unitCount;
+        byHealth = strategy == FocusStrategy::LowestHP || strategy == FocusStrategy::HighestHP;
+        preferHigher = strategy == FocusStrategy::HighestHP || strategy == FocusStrategy::HighestDamage;
+        leafCount = 1;
+        depth = 0;
+        while (leafCount < count) {
+            leafCount *= 2;
+            depth++;
+        }
+        tree.assign(2 * leafCount, -1);
+    }
+
+    bool keyedOnHealth() const { return byHealth; }
+
+    void rebuild(const vector<int>& keys, const vector<unsigned char>& alive) {
+        for (int i = 0; i < leafCount; ++i) {
+            tree[leafCount + i] = (i < count && alive[first + i]) ? first + i : -1;
+        }
+        for (int node = leafCount - 1; node >= 1; --node) {
+            tree[node] = better(keys, tree[2 * node], tree[2 * node + 1]);
+        }
+    }
+
+    void update(const vector<int>& keys, const vector<unsigned char>& alive, int unit) {
+        int node = leafCount + (unit - first);
+        tree[node] = alive[unit] ? unit : -1;
+        profileCount(ProfileEvent::TargetUpdates);
+        profileCount(ProfileEvent::TargetComparisons, depth);
+        for (node /= 2; node >= 1; node /= 2) {
+            tree[node] = better(keys, tree[2 * node], tree[2 * node + 1]);
+        }
+    }
+
+    // update() with the comparison fixed at compile time, for the specialised round loops.
+    template <bool PreferHigher>
+    void updateAs(const vector<int>& keys, const vector<unsigned char>& alive, int unit) {
+        int node = leafCount + (unit - first);
+        tree[node] = alive[unit] ? unit : -1;
+        profileCount(ProfileEvent::TargetUpdates);
+        profileCount(ProfileEvent::TargetComparisons, depth);
+        for (node /= 2; node >= 1; node /= 2) {
+            tree[node] = betterOf<PreferHigher>(keys, tree[2 * node], tree[2 * node + 1]);
+        }
+    }
+
+    int best() const { return tree[1]; }
+};
+
+template <FocusStrategy Strategy>
+struct FocusTraits {
+    static constexpr bool byHealth = Strategy == FocusStrategy::LowestHP || Strategy == FocusStrategy::HighestHP;
+    static constexpr bool preferHigher = Strategy == FocusStrategy::HighestHP || Strategy == FocusStrategy::HighestDamage;
+};
+
+// Uniform grid over one side's living units, rebuilt by counting sort before the other side acts, so finding
+// the enemies within reach of an attacker touches only the few cells its range overlaps.
+class SpatialGrid {
+private:
+    float cellSize = 1.0f;
+    float originX = 0.0f;
+    float originY = 0.0f;
+    int columns = 1;
+    int rows = 1;
+    vector<int> cellStart;
+    vector<int> entries;
+    vector<int> unitCell;
+
+    int clampColumn(float x) const { return min(columns - 1, max(0, static_cast<int>((x - originX) / cellSize))); }
+    int clampRow(float y) const { return min(rows - 1, max(0, static_cast<int>((y - originY) / cellSize))); }
+
+public:
+    float centroidX = 0.0f;
+    float centroidY = 0.0f;
+
+    void build(const vector<float>& x, const vector<float>& y, const vector<unsigned char>& alive, int begin, int end, float minCell) {
+        float minX = 0, maxX = 0, minY = 0, maxY = 0;
+        double sumX = 0, sumY = 0;
+        int living = 0;
+        for (int i = begin; i < end; ++i) {
+            if (!alive[i]) continue;
+            if (living == 0) {
+                minX = maxX = x[i];
+                minY = maxY = y[i];
+            }
+            minX = min(minX, x[i]);
+            maxX = max(maxX, x[i]);
+            minY = min(minY, y[i]);
+            maxY = max(maxY, y[i]);
+            sumX += x[i];
+            sumY += y[i];
+            living++;
+        }
+        if (living > 0) {
+            centroidX = static_cast<float>(sumX / living);
+            centroidY = static_cast<float>(sumY / living);
+        }
+
+        // Scattered survivors must not blow up the cell count; keep it within a few cells per unit.
+        cellSize = minCell;
+        double area = (static_cast<double>(maxX - minX) + cellSize) * (static_cast<double>(maxY - minY) + cellSize);
+        double cellLimit = 4.0 * living + 64.0;
+        if (area / (static_cast<double>(cellSize) * cellSize) > cellLimit) cellSize = static_cast<float>(sqrt(area / cellLimit));
+        originX = minX;
+        originY = minY;
+        columns = static_cast<int>((maxX - minX) / cellSize) + 1;
+        rows = static_cast<int>((maxY - minY) / cellSize) + 1;
+
+        cellStart.assign(static_cast<size_t>(columns) * rows + 1, 0);
+        unitCell.resize(end - begin);
+        for (int i = begin; i < end; ++i) {
+            if (!alive[i]) continue;
+            unitCell[i - begin] = clampRow(y[i]) * columns + clampColumn(x[i]);
+            cellStart[unitCell[i - begin] + 1]++;
+        }
+        for (size_t c = 1; c < cellStart.size(); ++c) cellStart[c] += cellStart[c - 1];
+        entries.resize(living);
+        for (int i = begin; i < end; ++i) {
+            if (alive[i]) entries[cellStart[unitCell[i - begin]]++] = i;
+        }
+        for (size_t c = cellStart.size() - 1; c > 0; --c) cellStart[c] = cellStart[c - 1];
+        cellStart[0] = 0;
+    }
+
+    // Calls visit(unit) for every unit in a cell overlapping the square of half-width radius around (px, py).
+    template <typename Visit>
+    void forEachNear(float px, float py, float radius, Visit visit) const {
+        int columnEnd = clampColumn(px + radius), rowEnd = clampRow(py + radius);
+        for (int row = clampRow(py - radius); row <= rowEnd; ++row) {
+            for (int column = clampColumn(px - radius); column <= columnEnd; ++column) {
+                int cell = row * columns + column;
+                for (int e = cellStart[cell]; e < cellStart[cell + 1]; ++e) visit(entries[e]);
+            }
+        }
+    }
+};
+
+// One unit's CombatState columns; the same class, level and equipment always give the same profile.
+struct UnitProfile {
+    int health;
+    int maxHealth;
+    int mana;
+    int attackDamage;
+    int damagePotential;
+    int spellDamage;
+    int spellCost;
+    unsigned char hasSpell;
+    int spellId[SpellsPerClass];
+    int level;
+    double armorFactor;
+    float range;
+
+    static UnitProfile of(const Character* c) {
+        int spells = c->getSpellCount();
+        UnitProfile profile;
+        profile.health = c->getHealth();
+        profile.maxHealth = c->getMaxHealth();
+        profile.mana = c->getMana();
+        profile.attackDamage = c->getAttackDamage();
+        profile.damagePotential = c->getDamagePotential();
+        profile.hasSpell = spells == 0 ? 0 : 1;
+        profile.spellDamage = spells == 0 ? 0 : c->getSpell(0).getDamage();
+        profile.spellCost = spells == 0 ? 0 : c->getSpell(0).getManaCost();
+        for (int slot = 0; slot < SpellsPerClass; ++slot) {
+            profile.spellId[slot] = slot < spells ? c->getSpell(slot).getId() : -1;
+        }
+        profile.level = c->getLevel();
+        profile.armorFactor = c->getArmor() ? c->getArmor()->getReductionFactor() : 0.0;
+        profile.range = attackRange(c->getCharacterClass());
+        return profile;
+    }
+};
+
+struct CombatState {
+    enum HitKind { AttackHit, PotentialHit, SpellHit, HitKindCount };
+
+    int group1Size = 0;
+    int unitCount = 0;
+    int turns = 0;
+    FocusStrategy strategy[2] = { FocusStrategy::LowestHP, FocusStrategy::LowestHP };
+    vector<int> health;
+    vector<int> maxHealth;
+    vector<int> mana;
+    vector<int> startMana;
+    vector<int> attackDamage;
+    vector<int> damagePotential;
+    vector<int> spellDamage;
+    vector<int> spellCost;
+    vector<unsigned char> armorKind;
+    vector<double> armorKindFactor = { 0.0 };
+    vector<int> hitDamage;
+    vector<unsigned char> hasSpell;
+    vector<unsigned char> alive;
+    vector<float> range;
+    TargetIndex targets[2];
+
+    // Spell books: SpellsPerClass slots per unit, at unit * SpellsPerClass + slot. Slot 0 is also in spellDamage
+    // and spellCost, which is all the First policy (and the SIMD and exact engines) ever read.
+    SpellPolicy spellPolicy = SpellPolicy::First;
+    vector<int> slotSpell;
+    vector<int> slotDamage;
+    vector<int> slotCost;
+    vector<int> slotCooldown;
+    vector<int> slotWeight;
+    vector<int> slotHitDamage;
+    vector<int> readyTurn;
+
+    // Positional mode: units start in formation and must be within range of their target.
+    bool positional = false;
+    float gridCell = 1.0f;
+    vector<float> startX;
+    vector<float> startY;
+    vector<float> x;
+    vector<float> y;
+    SpatialGrid grid;
+
+    const vector<int>& targetKeys(int side) const {
+        return targets[side].keyedOnHealth() ? health : damagePotential;
+    }
+
+    void addUnit(const Character* c) { addProfile(UnitProfile::of(c)); }
+
+    void addProfile(const UnitProfile& unit) {
+        health.push_back(unit.health);
+        maxHealth.push_back(unit.maxHealth);
+        mana.push_back(unit.mana);
+        startMana.push_back(unit.mana);
+        attackDamage.push_back(unit.attackDamage);
+        damagePotential.push_back(unit.damagePotential);
+        hasSpell.push_back(unit.hasSpell);
+        spellDamage.push_back(unit.spellDamage);
+        spellCost.push_back(unit.spellCost);
+        addSpellBook(unit.spellId, unit.level);
+
+        size_t kind = find(armorKindFactor.begin(), armorKindFactor.end(), unit.armorFactor) - armorKindFactor.begin();
+        if (kind == armorKindFactor.size()) armorKindFactor.push_back(unit.armorFactor);
+        armorKind.push_back(static_cast<unsigned char>(kind));
+        alive.push_back(unit.health > 0 ? 1 : 0);
+        range.push_back(unit.range);
+        unitCount++;
+    }
+
+    // Empty slots (id -1) never cast. Weights are damage per mana point, for the Weighted policy.
+    void addSpellBook(const int* ids, int level) {
+        for (int slot = 0; slot < SpellsPerClass; ++slot) {
+            bool known = ids[slot] >= 0;
+            Spell spell(known ? ids[slot] : 0, level);
+            slotSpell.push_back(known ? ids[slot] : -1);
+            slotDamage.push_back(known ? spell.getDamage() : 0);
+            slotCost.push_back(known ? spell.getManaCost() : 0);
+            slotCooldown.push_back(known ? spell.getCooldown() : 0);
+            slotWeight.push_back(known ? max(1, spell.getDamage() * 256 / max(1, spell.getManaCost())) : 0);
+            readyTurn.push_back(0);
+        }
+    }
+
+    // Switches to the positional mode: each group forms a block of ranks facing the other across `gap`,
+    // `spacing` apart, with the front rank first.
+    void deploy(float spacing, float gap) {
+        positional = true;
+        startX.assign(unitCount, 0.0f);
+        startY.assign(unitCount, 0.0f);
+        gridCell = 1.0f;
+        for (int side = 0; side < 2; ++side) {
+            int begin = side == 0 ? 0 : group1Size;
+            int size = (side == 0 ? group1Size : unitCount) - begin;
+            int files = max(1, static_cast<int>(ceil(sqrt(static_cast<double>(size)))));
+            for (int k = 0; k < size; ++k) {
+                float depth = gap / 2 + (k / files) * spacing;
+                startX[begin + k] = side == 0 ? -depth : depth;
+                startY[begin + k] = (k % files - (files - 1) / 2.0f) * spacing;
+            }
+        }
+        for (float reach : range) gridCell = max(gridCell, reach);
+        x = startX;
+        y = startY;
+    }
+
+    static CombatState build(const vector<Character*>& group1, const vector<Character*>& group2,
+                             FocusStrategy strategy1, FocusStrategy strategy2) {
+        CombatState state;
+        state.strategy[0] = strategy1;
+        state.strategy[1] = strategy2;
+        for (const Character* c : group1) state.addUnit(c);
+        state.group1Size = state.unitCount;
+        for (const Character* c : group2) state.addUnit(c);
+        state.buildHitTable();
+        state.initTargets();
+        return state;
+    }
+
+    // Called once the unit columns and strategies are filled in, however they were loaded.
+    void initTargets() {
+        targets[0].init(0, group1Size, strategy[1]);
+        targets[1].init(group1Size, unitCount - group1Size, strategy[0]);
+        targets[0].rebuild(targetKeys(0), alive);
+        targets[1].rebuild(targetKeys(1), alive);
+    }
+
+    // Damage after armor for every (attacker, armor kind, hit kind), so no hit does floating-point math.
+    void buildHitTable() {
+        int kinds = static_cast<int>(armorKindFactor.size());
+        hitDamage.assign(static_cast<size_t>(unitCount) * kinds * HitKindCount, 0);
+        for (int attacker = 0; attacker < unitCount; ++attacker) {
+            const int incoming[HitKindCount] = { attackDamage[attacker], damagePotential[attacker], spellDamage[attacker] };
+            for (int kind = 0; kind < kinds; ++kind) {
+                for (int hitKind = 0; hitKind < HitKindCount; ++hitKind) {
+                    hitDamage[(static_cast<size_t>(attacker) * kinds + kind) * HitKindCount + hitKind] =
+                        Armor::reduceDamage(incoming[hitKind], armorKindFactor[kind]);
+                }
+            }
+        }
+        buildSpellHitTable();
+    }
+
+    // The same for every spell slot; roster loads read the main table from the file but build this one.
+    void buildSpellHitTable() {
+        int kinds = static_cast<int>(armorKindFactor.size());
+        slotHitDamage.assign(static_cast<size_t>(unitCount) * kinds * SpellsPerClass, 0);
+        for (int attacker = 0; attacker < unitCount; ++attacker) {
+            for (int kind = 0; kind < kinds; ++kind) {
+                for (int slot = 0; slot < SpellsPerClass; ++slot) {
+                    slotHitDamage[(static_cast<size_t>(attacker) * kinds + kind) * SpellsPerClass + slot] =
+                        Armor::reduceDamage(slotDamage[attacker * SpellsPerClass + slot], armorKindFactor[kind]);
+                }
+            }
+        }
+    }
+
+    int hit(int attacker, int defender, HitKind hitKind) const {
+        size_t kinds = armorKindFactor.size();
+        return hitDamage[(attacker * kinds + armorKind[defender]) * HitKindCount + hitKind];
+    }
+
+    // Pays for `attacker`'s spell in `slot` and starts its cooldown; returns the spell's damage to `defender`.
+    int spendSpell(int attacker, int defender, int slot) {
+        int book = attacker * SpellsPerClass + slot;
+        mana[attacker] -= slotCost[book];
+        readyTurn[book] = turns + slotCooldown[book] + 1;
+        return slotHitDamage[(attacker * armorKindFactor.size() + armorKind[defender]) * SpellsPerClass + slot];
+    }
+
+    // FNV-1a over everything that affects a round, so a checkpoint can tell whether it belongs to this matchup.
+    uint64_t fingerprint() const {
+        uint64_t hash = 0xCBF29CE484222325ULL;
+        auto mix = [&hash](int64_t value) {
+            for (int i = 0; i < 8; ++i) {
+                hash ^= static_cast<uint64_t>(value >> (8 * i)) & 0xFF;
+                hash *= 0x100000001B3ULL;
+            }
+        };
+        mix(group1Size);
+        mix(unitCount);
+        mix(static_cast<int>(strategy[0]));
+        mix(static_cast<int>(strategy[1]));
+        for (int i = 0; i < unitCount; ++i) {
+            mix(maxHealth[i]);
+            mix(startMana[i]);
+            mix(damagePotential[i]);
+            mix(spellCost[i]);
+            mix(hasSpell[i]);
+            mix(armorKind[i]);
+        }
+        for (int damage : hitDamage) mix(damage);
+        if (spellPolicy != SpellPolicy::First) {
+            mix(static_cast<int>(spellPolicy));
+            for (size_t book = 0; book < slotSpell.size(); ++book) {
+                mix(slotSpell[book]);
+                mix(slotDamage[book]);
+                mix(slotCost[book]);
+                mix(slotCooldown[book]);
+            }
+        }
+        if (positional) {
+            auto bits = [](float value) {
+                uint32_t word;
+                memcpy(&word, &value, sizeof(word));
+                return static_cast<int64_t>(word);
+            };
+            for (int i = 0; i < unitCount; ++i) {
+                mix(bits(startX[i]));
+                mix(bits(startY[i]));
+                mix(bits(range[i]));
+            }
+        }
+        return hash;
+    }
+
+    // Every round starts from the roster as built, so rounds are independent of each other.
+    void resetRound() {
+        turns = 0;
+        for (int i = 0; i < unitCount; ++i) {
+            health[i] = maxHealth[i];
+            alive[i] = health[i] > 0;
+        }
+        copy(startMana.begin(), startMana.end(), mana.begin());
+        fill(readyTurn.begin(), readyTurn.end(), 0);
+        if (positional) {
+            x = startX;
+            y = startY;
+        }
+        targets[0].rebuild(targetKeys(0), alive);
+        targets[1].rebuild(targetKeys(1), alive);
+    }
+
+    void applyDamage(int unit, int actualDamage, int source, CombatEventSink* sink) {
+        health[unit] -= actualDamage;
+        if (health[unit] <= 0) {
+            if (alive[unit]) profileCount(ProfileEvent::Kills);
+            health[unit] = 0;
+            alive[unit] = 0;
+        }
+        int side = unit < group1Size ? 0 : 1;
+        if (targets[side].keyedOnHealth() || !alive[unit]) {
+            targets[side].update(targetKeys(side), alive, unit);
+        }
+        if (sink) sink->onEvent({ CombatEventType::Damage, source, unit, actualDamage, -1, health[unit] });
+    }
+
+    // applyDamage() for a unit on `side`, whose target index is known to be keyed by Strategy.
+    template <FocusStrategy Strategy>
+    void applyDamageAs(int side, int unit, int actualDamage, int source, CombatEventSink* sink) {
+        typedef FocusTraits<Strategy> Focus;
+        health[unit] -= actualDamage;
+        if (health[unit] <= 0) {
+            if (alive[unit]) profileCount(ProfileEvent::Kills);
+            health[unit] = 0;
+            alive[unit] = 0;
+        }
+        if (Focus::byHealth || !alive[unit]) {
+            targets[side].updateAs<Focus::preferHigher>(Focus::byHealth ? health : damagePotential, alive, unit);
+        }
+        if (sink) sink->onEvent({ CombatEventType::Damage, source, unit, actualDamage, -1, health[unit] });
+    }
+};
+
+// Philox4x32-10: a counter-based generator, so any block of bits is a pure function of (seed, round, block).
+// Round r only ever reads counters (r, 0), (r, 1), ..., which makes every round reproducible on its own,
+// whichever thread or process plays it.
+struct PhiloxBlock {
+    uint32_t word[4];
+};
+
+class BattleRng {
+private:
+    static constexpr uint64_t NoBlock = ~0ULL;
+
+    uint32_t key[2];
+    uint64_t roundIndex = 0;
+    uint64_t bitPosition = 0;
+    uint64_t cachedBlock = NoBlock;
+    PhiloxBlock bits;
+
+    void loadBlock(uint64_t blockIndex) {
+        bits = generate(key, roundIndex, blockIndex);
+        cachedBlock = blockIndex;
+    }
+
+public:
+    BattleRng(uint64_t seed, uint64_t round = 0) {
+        key[0] = static_cast<uint32_t>(seed);
+        key[1] = static_cast<uint32_t>(seed >> 32);
+        startRound(round);
+    }
+
+    static PhiloxBlock generate(const uint32_t key[2], uint64_t round, uint64_t blockIndex) {
+        uint32_t c0 = static_cast<uint32_t>(blockIndex), c1 = static_cast<uint32_t>(blockIndex >> 32);
+        uint32_t c2 = static_cast<uint32_t>(round), c3 = static_cast<uint32_t>(round >> 32);
+        uint32_t k0 = key[0], k1 = key[1];
+        for (int i = 0; i < 10; ++i) {
+            uint64_t p0 = static_cast<uint64_t>(0xD2511F53u) * c0;
+            uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57u) * c2;
+            uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+            uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+            c1 = static_cast<uint32_t>(p1);
+            c3 = static_cast<uint32_t>(p0);
+            c0 = n0;
+            c2 = n2;
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+        return { { c0, c1, c2, c3 } };
+    }
+
+    // Jumps straight to the first bit of the given round; nothing before it is generated.
+    void startRound(uint64_t round) {
+        roundIndex = round;
+        bitPosition = 0;
+        cachedBlock = NoBlock;
+    }
+
+    void skip(uint64_t flips) {
+        bitPosition += flips;
+    }
+
+    uint64_t round() const { return roundIndex; }
+    uint64_t position() const { return bitPosition; }
+
+    bool coinFlip() {
+        uint64_t blockIndex = bitPosition >> 7;
+        if (blockIndex != cachedBlock) loadBlock(blockIndex);
+        unsigned bit = static_cast<unsigned>(bitPosition & 127);
+        ++bitPosition;
+        return (bits.word[bit >> 5] >> (bit & 31)) & 1;
+    }
+
+    // The flip coinFlip() would return next, without consuming it.
+    bool peekFlip() {
+        uint64_t blockIndex = bitPosition >> 7;
+        if (blockIndex != cachedBlock) loadBlock(blockIndex);
+        unsigned bit = static_cast<unsigned>(bitPosition & 127);
+        return (bits.word[bit >> 5] >> (bit & 31)) & 1;
+    }
+
+    // The next `count` (1 to 32) flips packed into one value, flip i in bit i.
+    uint32_t nextBits(unsigned count) {
+        uint32_t result = 0;
+        unsigned filled = 0;
+        while (filled < count) {
+            uint64_t blockIndex = bitPosition >> 7;
+            if (blockIndex != cachedBlock) loadBlock(blockIndex);
+            unsigned bit = static_cast<unsigned>(bitPosition & 127);
+            unsigned take = min(count - filled, 32 - (bit & 31));
+            uint32_t word = bits.word[bit >> 5] >> (bit & 31);
+            if (take < 32) word &= (1u << take) - 1;
+            result |= word << filled;
+            filled += take;
+            bitPosition += take;
+        }
+        return result;
+    }
+
+    // The next 64 flips packed into one word, flip i in bit i.
+    uint64_t nextWord() {
+        if ((bitPosition & 63) != 0) {
+            uint64_t result = 0;
+            for (int i = 0; i < 64; ++i) result |= static_cast<uint64_t>(coinFlip()) << i;
+            return result;
+        }
+        uint64_t blockIndex = bitPosition >> 7;
+        if (blockIndex != cachedBlock) loadBlock(blockIndex);
+        unsigned half = static_cast<unsigned>((bitPosition >> 6) & 1);
+        bitPosition += 64;
+        return bits.word[2 * half] | (static_cast<uint64_t>(bits.word[2 * half + 1]) << 32);
+    }
+
+    // Fills out[0..words) with the next 64 * words flips, e.g. one bit per attacker for a whole turn.
+    void fillBits(uint64_t* out, size_t words) {
+        for (size_t i = 0; i < words; ++i) out[i] = nextWord();
+    }
+
+    uint32_t uniform(uint32_t bound) {
+        return static_cast<uint32_t>(((nextWord() >> 32) * bound) >> 32);
+    }
+};
+
+uint64_t randomSeed() {
+    random_device device;
+    return (static_cast<uint64_t>(device()) << 32) | device();
+}
+
+struct alignas(64) RoundTally {
+    long long group1Wins = 0;
+    long long group2Wins = 0;
+};
+
+struct WinInterval {
+    double estimate;
+    double lower;
+    double upper;
+};
+
+WinInterval wilsonInterval(long long wins, long long trials, double z) {
+    if (trials <= 0) return { 0.0, 0.0, 1.0 };
+    double n = static_cast<double>(trials);
+    double p = wins / n;
+    double z2 = z * z;
+    double center = (p + z2 / (2 * n)) / (1 + z2 / n);
+    double halfWidth = z * sqrt(p * (1 - p) / n + z2 / (4 * n * n)) / (1 + z2 / n);
+    return { p, max(0.0, center - halfWidth), min(1.0, center + halfWidth) };
+}
+
+// Raw host-order I/O for checkpoint files, which are only ever read back by the same build.
+template <typename T>
+void writeBinary(ostream& out, const T& value) {
+    static_assert(is_trivially_copyable<T>::value, "binary fields must be trivially copyable");
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+bool readBinary(istream& in, T& value) {
+    static_assert(is_trivially_copyable<T>::value, "binary fields must be trivially copyable");
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+// Welford's running mean and variance; merge() is Chan et al.'s pairwise combination.
+struct RunningMoments {
+    long long count = 0;
+    double mean = 0.0;
+    double m2 = 0.0;
+    double minimum = 0.0;
+    double maximum = 0.0;
+
+    void add(double value) {
+        count++;
+        double delta = value - mean;
+        mean += delta / count;
+        m2 += delta * (value - mean);
+        if (count == 1 || value < minimum) minimum = value;
+        if (count == 1 || value > maximum) maximum = value;
+    }
+
+    void merge(const RunningMoments& other) {
+        if (other.count == 0) return;
+        if (count == 0) {
+            *this = other;
+            return;
+        }
+        long long total = count + other.count;
+        double delta = other.mean - mean;
+        mean += delta * other.count / total;
+        m2 += other.m2 + delta * delta * (static_cast<double>(count) * other.count / total);
+        minimum = min(minimum, other.minimum);
+        maximum = max(maximum, other.maximum);
+        count = total;
+    }
+
+    double variance() const { return count > 1 ? m2 / (count - 1) : 0.0; }
+};
+
+// Buckets 0..Buckets-2 count exact values, the last one everything larger.
+template <int Buckets>
+struct FixedHistogram {
+    long long counts[Buckets] = {};
+
+    void add(int value) {
+        counts[min(max(value, 0), Buckets - 1)]++;
+    }
+
+    void merge(const FixedHistogram& other) {
+        for (int i = 0; i < Buckets; ++i) counts[i] += other.counts[i];
+    }
+};
+
+// Log-bucketed quantile sketch (as in DDSketch): bucket i holds values in (Gamma^(i-1), Gamma^i], so every
+// quantile is within ~1% of the true value, the size is fixed, and sketches merge by adding counts.
+class QuantileSketch {
+private:
+    static constexpr int Buckets = 1200;
+    static constexpr double Gamma = 1.02;
+
+    long long counts[Buckets] = {};
+    long long zeros = 0;
+    long long total = 0;
+
+public:
+    void add(double value) {
+        total++;
+        if (value <= 1.0) {
+            if (value <= 0.0) zeros++;
+            else counts[0]++;
+            return;
+        }
+        int bucket = static_cast<int>(ceil(log(value) / log(Gamma)));
+        counts[min(bucket, Buckets - 1)]++;
+    }
+
+    void merge(const QuantileSketch& other) {
+        for (int i = 0; i < Buckets; ++i) counts[i] += other.counts[i];
+        zeros += other.zeros;
+        total += other.total;
+    }
+
+    double quantile(double q) const {
+        if (total == 0) return 0.0;
+        long long rank = static_cast<long long>(q * (total - 1));
+        if (rank < zeros) return 0.0;
+        long long seen = zeros;
+        for (int i = 0; i < Buckets; ++i) {
+            seen += counts[i];
+            if (seen > rank) return i == 0 ? 1.0 : 2 * pow(Gamma, i) / (Gamma + 1);
+        }
+        return pow(Gamma, Buckets - 1);
+    }
+};
+
+// Everything below is sized by the roster, never by the number of rounds, and merges across workers.
+struct BattleStats {
+    static const int TurnBuckets = 64;
+
+    long long rounds = 0;
+    RunningMoments turns;
+    FixedHistogram<TurnBuckets> turnHistogram;
+    QuantileSketch turnQuantiles;
+    RunningMoments winnerSurvivors[2];
+    vector<RunningMoments> damageDealt;
+    vector<long long> spellCasts;
+    vector<long long> manaExhaustedRounds;
+
+    // Exact from the histogram unless the quantile falls in its overflow bucket.
+    double turnQuantile(double q) const {
+        long long rank = static_cast<long long>(q * max(0LL, turns.count - 1));
+        long long seen = 0;
+        for (int i = 0; i < TurnBuckets - 1; ++i) {
+            seen += turnHistogram.counts[i];
+            if (seen > rank) return i;
+        }
+        return turnQuantiles.quantile(q);
+    }
+
+    void reset(int unitCount) {
+        *this = BattleStats();
+        damageDealt.assign(unitCount, RunningMoments());
+        spellCasts.assign(unitCount, 0);
+        manaExhaustedRounds.assign(unitCount, 0);
+    }
+
+    void merge(const BattleStats& other) {
+        if (damageDealt.size() < other.damageDealt.size()) {
+            damageDealt.resize(other.damageDealt.size());
+            spellCasts.resize(other.damageDealt.size(), 0);
+            manaExhaustedRounds.resize(other.damageDealt.size(), 0);
+        }
+        rounds += other.rounds;
+        turns.merge(other.turns);
+        turnHistogram.merge(other.turnHistogram);
+        turnQuantiles.merge(other.turnQuantiles);
+        winnerSurvivors[0].merge(other.winnerSurvivors[0]);
+        winnerSurvivors[1].merge(other.winnerSurvivors[1]);
+        for (size_t i = 0; i < damageDealt.size(); ++i) {
+            damageDealt[i].merge(other.damageDealt[i]);
+            spellCasts[i] += other.spellCasts[i];
+            manaExhaustedRounds[i] += other.manaExhaustedRounds[i];
+        }
+    }
+
+    void save(ostream& out) const {
+        writeBinary(out, rounds);
+        writeBinary(out, turns);
+        writeBinary(out, turnHistogram);
+        writeBinary(out, turnQuantiles);
+        writeBinary(out, winnerSurvivors);
+        writeBinary(out, static_cast<uint32_t>(damageDealt.size()));
+        for (size_t i = 0; i < damageDealt.size(); ++i) {
+            writeBinary(out, damageDealt[i]);
+            writeBinary(out, spellCasts[i]);
+            writeBinary(out, manaExhaustedRounds[i]);
+        }
+    }
+
+    bool load(istream& in) {
+        uint32_t units = 0;
+        if (!readBinary(in, rounds) || !readBinary(in, turns) || !readBinary(in, turnHistogram) ||
+            !readBinary(in, turnQuantiles) || !readBinary(in, winnerSurvivors) || !readBinary(in, units)) {
+            return false;
+        }
+        damageDealt.assign(units, RunningMoments());
+        spellCasts.assign(units, 0);
+        manaExhaustedRounds.assign(units, 0);
+        for (uint32_t i = 0; i < units; ++i) {
+            if (!readBinary(in, damageDealt[i]) || !readBinary(in, spellCasts[i]) || !readBinary(in, manaExhaustedRounds[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+class LogEventSink : public CombatEventSink {
+private:
+    vector<const Character*> units;
+
+    static const char* attackVerb(CharacterClass characterClass) {
+        switch (characterClass) {
+            case CharacterClass::Warrior: return "swings a sword at";
+            case CharacterClass::Archer: return "shoots an arrow at";
+            case CharacterClass::Mage: return "shoots a firebolt at";
+        }
+        return "attacks";
+    }
+
+public:
+    LogEventSink(const vector<Character*>& group1, const vector<Character*>& group2) {
+        units.insert(units.end(), group1.begin(), group1.end());
+        units.insert(units.end(), group2.begin(), group2.end());
+    }
+
+    void onEvent(const CombatEvent& event) override {
+        const Character* actor = event.actor >= 0 ? units[event.actor] : nullptr;
+        const Character* target = units[event.target];
+
+        switch (event.type) {
+            case CombatEventType::Attack:
+                cout << actor->getName() << " " << attackVerb(actor->getCharacterClass()) << " " << target->getName()
+                     << ", dealing " << event.amount << " damage!" << endl;
+                break;
+            case CombatEventType::SpellCast:
+                cout << actor->getName() << " casts " << spellTable[event.spellId].name << " on "
+                     << target->getName() << ", dealing " << event.amount << " damage!" << endl;
+                break;
+            case CombatEventType::SpellFailed:
+                cout << actor->getName() << " doesn't have enough mana to cast "
+                     << spellTable[event.spellId].name << "!" << endl;
+                break;
+            case CombatEventType::Damage:
+                cout << target->getName() << " takes " << event.amount << " damage. Health is now " << event.healthAfter << ".";
+                if (event.healthAfter == 0) {
+                    cout << " " << target->getName() << " dies!";
+                }
+                cout << endl;
+                break;
+            case CombatEventType::Move:
+                cout << actor->getName() << " advances towards the enemy." << endl;
+                break;
+        }
+    }
+};
+
+// Collects one round's damage and casts from the event stream, then folds the round into BattleStats.
+class StatsEventSink : public CombatEventSink {
+private:
+    BattleStats& stats;
+    vector<long long> roundDamage;
+
+public:
+    StatsEventSink(BattleStats& stats, int unitCount) : stats(stats), roundDamage(unitCount, 0) {}
+
+    void onEvent(const CombatEvent& event) override {
+        if (event.type == CombatEventType::Damage && event.actor >= 0) {
+            roundDamage[event.actor] += event.amount;
+        } else if (event.type == CombatEventType::SpellCast) {
+            stats.spellCasts[event.actor]++;
+        }
+    }
+
+    void endRound(const CombatState& state, int winner) {
+        stats.rounds++;
+        stats.turns.add(state.turns);
+        stats.turnHistogram.add(state.turns);
+        stats.turnQuantiles.add(state.turns);
+
+        int side = winner - 1;
+        int begin = side == 0 ? 0 : state.group1Size;
+        int end = side == 0 ? state.group1Size : state.unitCount;
+        int survivors = 0;
+        for (int i = begin; i < end; ++i) survivors += state.alive[i];
+        stats.winnerSurvivors[side].add(survivors);
+
+        for (int i = 0; i < state.unitCount; ++i) {
+            stats.damageDealt[i].add(static_cast<double>(roundDamage[i]));
+            roundDamage[i] = 0;
+            if (state.hasSpell[i] && state.mana[i] < state.spellCost[i]) stats.manaExhaustedRounds[i]++;
+        }
+    }
+};
+
+// The spell slot `attacker` casts once its coin flip says it tries, or -1 when nothing is castable. The First
+// policy is the classic rule and never looks past slot 0; the others skip slots it cannot pay for or that are
+// still cooling down.
+inline int chooseSpell(const CombatState& state, int attacker, BattleRng& rng) {
+    if (state.spellPolicy == SpellPolicy::First) return state.mana[attacker] >= state.spellCost[attacker] ? 0 : -1;
+    const int first = attacker * SpellsPerClass;
+    uint32_t weights[SpellsPerClass];
+    uint32_t total = 0;
+    int strongest = -1;
+    for (int slot = 0; slot < SpellsPerClass; ++slot) {
+        int book = first + slot;
+        bool castable = state.slotSpell[book] >= 0 && state.mana[attacker] >= state.slotCost[book] && state.readyTurn[book] <= state.turns;
+        weights[slot] = castable ? static_cast<uint32_t>(state.slotWeight[book]) : 0;
+        total += weights[slot];
+        if (castable && (strongest < 0 || state.slotDamage[book] > state.slotDamage[first + strongest])) strongest = slot;
+    }
+    if (state.spellPolicy == SpellPolicy::Strongest || total == 0) return strongest;
+    uint32_t pick = static_cast<uint32_t>((static_cast<uint64_t>(rng.nextBits(16)) * total) >> 16);
+    for (int slot = 0; slot < SpellsPerClass; ++slot) {
+        if (pick < weights[slot]) return slot;
+        pick -= weights[slot];
+    }
+    return strongest;
+}
+
+int playRound(CombatState& state, BattleRng& rng, CombatEventSink* sink = nullptr) {
+    ProfileLap lap;
+    state.resetRound();
+    lap.mark(ProfilePhase::RoundReset);
+    lap.count(ProfileEvent::Rounds);
+
+    const int sideBegin[2] = { 0, state.group1Size };
+    const int sideEnd[2] = { state.group1Size, state.unitCount };
+
+    while (true) {
+        state.turns++;
+        lap.count(ProfileEvent::Turns);
+        for (int side = 0; side < 2; ++side) {
+            for (int attacker = sideBegin[side]; attacker < sideEnd[side]; ++attacker) {
+                if (!state.alive[attacker]) continue;
+
+                int defender = state.targets[1 - side].best();
+                lap.count(ProfileEvent::TargetScans);
+                lap.mark(ProfilePhase::TargetSelect);
+                if (defender < 0) {
+                    return side + 1;
+                }
+
+                lap.count(ProfileEvent::Attacks);
+                if (sink) sink->onEvent({ CombatEventType::Attack, attacker, defender, state.attackDamage[attacker], -1, state.health[defender] });
+                state.applyDamage(defender, state.hit(attacker, defender, CombatState::AttackHit), attacker, sink);
+                state.applyDamage(defender, state.hit(attacker, defender, CombatState::PotentialHit), attacker, sink);
+                lap.mark(ProfilePhase::Damage);
+
+                if (!state.alive[defender]) continue;
+
+                if (state.hasSpell[attacker] && rng.coinFlip()) {
+                    int slot = chooseSpell(state, attacker, rng);
+                    if (slot >= 0) {
+                        int spellHit = state.spendSpell(attacker, defender, slot);
+                        lap.count(ProfileEvent::SpellsCast);
+                        if (sink) {
+                            int book = attacker * SpellsPerClass + slot;
+                            sink->onEvent({ CombatEventType::SpellCast, attacker, defender, state.slotDamage[book], state.slotSpell[book], state.health[defender] });
+                        }
+                        state.applyDamage(defender, spellHit, attacker, sink);
+                        state.applyDamage(defender, spellHit, attacker, sink);
+                    }
+                }
+                lap.mark(ProfilePhase::Spell);
+            }
+        }
+    }
+}
+
+// playRound for one side with its focus strategy fixed at compile time; false when nobody is left to hit.
+template <FocusStrategy Strategy>
+inline bool attackSideAs(CombatState& state, BattleRng& rng, CombatEventSink* sink, int side) {
+    const int defenderSide = 1 - side;
+    const int begin = side == 0 ? 0 : state.group1Size;
+    const int end = side == 0 ? state.group1Size : state.unitCount;
+    ProfileLap lap;
+
+    for (int attacker = begin; attacker < end; ++attacker) {
+        if (!state.alive[attacker]) continue;
+
+        int defender = state.targets[defenderSide].best();
+        lap.count(ProfileEvent::TargetScans);
+        lap.mark(ProfilePhase::TargetSelect);
+        if (defender < 0) return false;
+
+        lap.count(ProfileEvent::Attacks);
+        if (sink) sink->onEvent({ CombatEventType::Attack, attacker, defender, state.attackDamage[attacker], -1, state.health[defender] });
+        state.applyDamageAs<Strategy>(defenderSide, defender, state.hit(attacker, defender, CombatState::AttackHit), attacker, sink);
+        state.applyDamageAs<Strategy>(defenderSide, defender, state.hit(attacker, defender, CombatState::PotentialHit), attacker, sink);
+        lap.mark(ProfilePhase::Damage);
+
+        if (!state.alive[defender]) continue;
+
+        if (state.hasSpell[attacker] && rng.coinFlip()) {
+            int slot = chooseSpell(state, attacker, rng);
+            if (slot >= 0) {
+                int spellHit = state.spendSpell(attacker, defender, slot);
+                lap.count(ProfileEvent::SpellsCast);
+                if (sink) {
+                    int book = attacker * SpellsPerClass + slot;
+                    sink->onEvent({ CombatEventType::SpellCast, attacker, defender, state.slotDamage[book], state.slotSpell[book], state.health[defender] });
+                }
+                state.applyDamageAs<Strategy>(defenderSide, defender, spellHit, attacker, sink);
+                state.applyDamageAs<Strategy>(defenderSide, defender, spellHit, attacker, sink);
+            }
+        }
+        lap.mark(ProfilePhase::Spell);
+    }
+    return true;
+}
+
+// Same rounds as playRound, for a state built with exactly these two strategies.
+template <FocusStrategy Strategy1, FocusStrategy Strategy2>
+int playRoundAs(CombatState& state, BattleRng& rng, CombatEventSink* sink) {
+    ProfileLap lap;
+    state.resetRound();
+    lap.mark(ProfilePhase::RoundReset);
+    lap.count(ProfileEvent::Rounds);
+    while (true) {
+        state.turns++;
+        lap.count(ProfileEvent::Turns);
+        if (!attackSideAs<Strategy1>(state, rng, sink, 0)) return 1;
+        if (!attackSideAs<Strategy2>(state, rng, sink, 1)) return 2;
+    }
+}
+
+const int MaxPositionalTurns = 10000;
+const float PositionalStep = 1.0f;
+
+// Round of the positional mode. Before a side acts, the enemy's living units are binned into the grid; each
+// attacker then picks, by its side's FocusStrategy, among the enemies within its range (ties to the lower
+// index, as elsewhere), or steps towards the enemy's centre when none is. Damage and spells follow playRound.
+// After MaxPositionalTurns the side with more health left wins, group 2 on a tie.
+int playPositionalRound(CombatState& state, BattleRng& rng, CombatEventSink* sink) {
+    ProfileLap lap;
+    state.resetRound();
+    lap.mark(ProfilePhase::RoundReset);
+    lap.count(ProfileEvent::Rounds);
+
+    const int sideBegin[2] = { 0, state.group1Size };
+    const int sideEnd[2] = { state.group1Size, state.unitCount };
+    int living[2] = { 0, 0 };
+    for (int i = 0; i < state.unitCount; ++i) living[i < state.group1Size ? 0 : 1] += state.alive[i];
+
+    auto applyDamage = [&](int unit, int amount, int source) {
+        state.health[unit] -= amount;
+        if (state.health[unit] <= 0) {
+            if (state.alive[unit]) {
+                living[unit < state.group1Size ? 0 : 1]--;
+                profileCount(ProfileEvent::Kills);
+            }
+            state.health[unit] = 0;
+            state.alive[unit] = 0;
+        }
+        if (sink) sink->onEvent({ CombatEventType::Damage, source, unit, amount, -1, state.health[unit] });
+    };
+
+    while (state.turns < MaxPositionalTurns) {
+        state.turns++;
+        lap.count(ProfileEvent::Turns);
+        for (int side = 0; side < 2; ++side) {
+            const int defenderSide = 1 - side;
+            if (living[defenderSide] == 0) return side + 1;
+            state.grid.build(state.x, state.y, state.alive, sideBegin[defenderSide], sideEnd[defenderSide], state.gridCell);
+
+            FocusStrategy strategy = state.strategy[side];
+            bool preferHigher = strategy == FocusStrategy::HighestHP || strategy == FocusStrategy::HighestDamage;
+            bool byHealth = strategy == FocusStrategy::LowestHP || strategy == FocusStrategy::HighestHP;
+            const vector<int>& keys = byHealth ? state.health : state.damagePotential;
+
+            for (int attacker = sideBegin[side]; attacker < sideEnd[side]; ++attacker) {
+                if (!state.alive[attacker]) continue;
+                if (living[defenderSide] == 0) return side + 1;
+
+                const float ax = state.x[attacker], ay = state.y[attacker], reach = state.range[attacker];
+                int defender = -1, bestKey = 0, comparisons = 0;
+                state.grid.forEachNear(ax, ay, reach, [&](int enemy) {
+                    if (!state.alive[enemy]) return;
+                    comparisons++;
+                    float dx = state.x[enemy] - ax, dy = state.y[enemy] - ay;
+                    if (dx * dx + dy * dy > reach * reach) return;
+                    int key = keys[enemy];
+                    bool better = preferHigher ? key > bestKey : key < bestKey;
+                    if (defender < 0 || better || (key == bestKey && enemy < defender)) {
+                        defender = enemy;
+                        bestKey = key;
+                    }
+                });
+                lap.count(ProfileEvent::TargetScans);
+                profileCount(ProfileEvent::TargetComparisons, comparisons);
+
+                if (defender < 0) {
+                    float dx = state.grid.centroidX - ax, dy = state.grid.centroidY - ay;
+                    float distance = sqrt(dx * dx + dy * dy);
+                    if (distance > 0) {
+                        float step = min(PositionalStep, distance);
+                        state.x[attacker] += dx / distance * step;
+                        state.y[attacker] += dy / distance * step;
+                    }
+                    if (sink) sink->onEvent({ CombatEventType::Move, attacker, attacker, 0, -1, state.health[attacker] });
+                    lap.mark(ProfilePhase::TargetSelect);
+                    continue;
+                }
+                lap.mark(ProfilePhase::TargetSelect);
+
+                lap.count(ProfileEvent::Attacks);
+                if (sink) sink->onEvent({ CombatEventType::Attack, attacker, defender, state.attackDamage[attacker], -1, state.health[defender] });
+                applyDamage(defender, state.hit(attacker, defender, CombatState::AttackHit), attacker);
+                applyDamage(defender, state.hit(attacker, defender, CombatState::PotentialHit), attacker);
+                lap.mark(ProfilePhase::Damage);
+
+                if (!state.alive[defender]) continue;
+
+                if (state.hasSpell[attacker] && rng.coinFlip()) {
+                    int slot = chooseSpell(state, attacker, rng);
+                    if (slot >= 0) {
+                        int spellHit = state.spendSpell(attacker, defender, slot);
+                        lap.count(ProfileEvent::SpellsCast);
+                        if (sink) {
+                            int book = attacker * SpellsPerClass + slot;
+                            sink->onEvent({ CombatEventType::SpellCast, attacker, defender, state.slotDamage[book], state.slotSpell[book], state.health[defender] });
+                        }
+                        applyDamage(defender, spellHit, attacker);
+                        applyDamage(defender, spellHit, attacker);
+                    }
+                }
+                lap.mark(ProfilePhase::Spell);
+            }
+        }
+    }
+
+    long long remaining[2] = { 0, 0 };
+    for (int i = 0; i < state.unitCount; ++i) remaining[i < state.group1Size ? 0 : 1] += state.health[i];
+    return remaining[0] > remaining[1] ? 1 : 2;
+}
+
+typedef int (*RoundFunction)(CombatState&, BattleRng&, CombatEventSink*);
+
+template <FocusStrategy Strategy1>
+RoundFunction roundFunctionFor(FocusStrategy strategy2) {
+    switch (strategy2) {
+        case FocusStrategy::LowestHP: return &playRoundAs<Strategy1, FocusStrategy::LowestHP>;
+        case FocusStrategy::HighestHP: return &playRoundAs<Strategy1, FocusStrategy::HighestHP>;
+        case FocusStrategy::LowestDamage: return &playRoundAs<Strategy1, FocusStrategy::LowestDamage>;
+        case FocusStrategy::HighestDamage: return &playRoundAs<Strategy1, FocusStrategy::HighestDamage>;
+    }
+    return &playRoundAs<Strategy1, FocusStrategy::LowestHP>;
+}
+
+// Picks one of the 16 specialised loops, or the positional round; done once per block of rounds, never per attack.
+RoundFunction roundFunctionFor(const CombatState& state) {
+    if (state.positional) return &playPositionalRound;
+    switch (state.strategy[0]) {
+        case FocusStrategy::LowestHP: return roundFunctionFor<FocusStrategy::LowestHP>(state.strategy[1]);
+        case FocusStrategy::HighestHP: return roundFunctionFor<FocusStrategy::HighestHP>(state.strategy[1]);
+        case FocusStrategy::LowestDamage: return roundFunctionFor<FocusStrategy::LowestDamage>(state.strategy[1]);
+        case FocusStrategy::HighestDamage: return roundFunctionFor<FocusStrategy::HighestDamage>(state.strategy[1]);
+    }
+    return &playRoundAs<FocusStrategy::LowestHP, FocusStrategy::LowestHP>;
+}
+
+// Exact win probability for small classic matchups (not positional, First spell policy). Given the coin
+// flips, a round is deterministic, so its outcome is a function of every unit's health and mana and whose
+// attack is next; memoising that over a search that branches 50/50 wherever a flip can change anything
+// gives the probability the Monte Carlo engines estimate, without sampling error.
+const int MaxExactUnitsPerSide = 4;
+const size_t ExactStateLimit = 1 << 20;
+
+struct ExactResult {
+    bool solved = false;
+    double probability = 0.0;
+    long long states = 0;
+};
+
+class ExactSolver {
+private:
+    static const int MaxUnits = 2 * MaxExactUnitsPerSide;
+
+    struct Key {
+        uint16_t value[2 * MaxUnits + 1];
+
+        bool operator==(const Key& other) const { return memcmp(value, other.value, sizeof(value)) == 0; }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            uint64_t hash = 0xCBF29CE484222325ULL;
+            for (uint16_t v : key.value) hash = (hash ^ v) * 0x100000001B3ULL;
+            return static_cast<size_t>(hash ^ (hash >> 32));
+        }
+    };
+
+    const CombatState& state;
+    size_t stateLimit;
+    unordered_map<Key, double, KeyHash> memo;
+    bool overflow = false;
+
+    int sideOf(int unit) const { return unit < state.group1Size ? 0 : 1; }
+
+    // The unit the side's tournament tree would hold at its root: best key, ties to the lower index.
+    int pickTarget(int attackerSide, const int* health) const {
+        FocusStrategy strategy = state.strategy[attackerSide];
+        bool byHealth = strategy == FocusStrategy::LowestHP || strategy == FocusStrategy::HighestHP;
+        bool preferHigher = strategy == FocusStrategy::HighestHP || strategy == FocusStrategy::HighestDamage;
+        int begin = attackerSide == 0 ? state.group1Size : 0;
+        int end = attackerSide == 0 ? state.unitCount : state.group1Size;
+        int best = -1;
+        for (int unit = begin; unit < end; ++unit) {
+            if (health[unit] <= 0) continue;
+            int key = byHealth ? health[unit] : state.damagePotential[unit];
+            int bestKey = best < 0 ? 0 : (byHealth ? health[best] : state.damagePotential[best]);
+            if (best < 0 || (preferHigher ? key > bestKey : key < bestKey)) best = unit;
+        }
+        return best;
+    }
+
+    bool sideAlive(int side, const int* health) const {
+        int begin = side == 0 ? 0 : state.group1Size;
+        int end = side == 0 ? state.group1Size : state.unitCount;
+        for (int unit = begin; unit < end; ++unit) {
+            if (health[unit] > 0) return true;
+        }
+        return false;
+    }
+
+    // Group 1's chance to win when `cursor` is the next unit in attack order (dead units are skipped).
+    double value(const int* health, const int* mana, int cursor) {
+        while (health[cursor] <= 0) cursor = (cursor + 1) % state.unitCount;
+
+        Key key;
+        memset(&key, 0, sizeof(key));
+        // Every dead unit is 0 in the key, however far below zero its last hit took it.
+        for (int unit = 0; unit < state.unitCount; ++unit) {
+            key.value[unit] = static_cast<uint16_t>(max(health[unit], 0));
+            key.value[MaxUnits + unit] = static_cast<uint16_t>(state.hasSpell[unit] ? mana[unit] : 0);
+        }
+        key.value[2 * MaxUnits] = static_cast<uint16_t>(cursor);
+        auto found = memo.find(key);
+        if (found != memo.end()) return found->second;
+        if (overflow || memo.size() >= stateLimit) {
+            overflow = true;
+            return 0.0;
+        }
+
+        const int attacker = cursor, side = sideOf(attacker), next = (cursor + 1) % state.unitCount;
+        const double sideWins = side == 0 ? 1.0 : 0.0;
+        int defender = pickTarget(side, health);
+
+        int afterAttack[MaxUnits];
+        copy(health, health + state.unitCount, afterAttack);
+        afterAttack[defender] -= state.hit(attacker, defender, CombatState::AttackHit);
+        afterAttack[defender] -= state.hit(attacker, defender, CombatState::PotentialHit);
+
+        double result;
+        if (!sideAlive(1 - side, afterAttack)) {
+            result = sideWins;
+        } else if (afterAttack[defender] <= 0 || !state.hasSpell[attacker] || mana[attacker] < state.spellCost[attacker]) {
+            result = value(afterAttack, mana, next);
+        } else {
+            int afterSpell[MaxUnits], spent[MaxUnits];
+            copy(afterAttack, afterAttack + state.unitCount, afterSpell);
+            copy(mana, mana + state.unitCount, spent);
+            afterSpell[defender] -= 2 * state.hit(attacker, defender, CombatState::SpellHit);
+            spent[attacker] -= state.spellCost[attacker];
+            double cast = sideAlive(1 - side, afterSpell) ? value(afterSpell, spent, next) : sideWins;
+            result = 0.5 * value(afterAttack, mana, next) + 0.5 * cast;
+        }
+        memo.emplace(key, result);
+        return result;
+    }
+
+public:
+    ExactSolver(const CombatState& state, size_t stateLimit) : state(state), stateLimit(stateLimit) {}
+
+    // Whether the search is well defined here: small classic groups, values that fit the key, and every
+    // attack doing damage (otherwise a round could cycle forever).
+    bool supported() const {
+        if (state.positional || state.spellPolicy != SpellPolicy::First || state.group1Size < 1 || state.group1Size > MaxExactUnitsPerSide ||
+            state.unitCount - state.group1Size < 1 || state.unitCount - state.group1Size > MaxExactUnitsPerSide) {
+            return false;
+        }
+        for (int unit = 0; unit < state.unitCount; ++unit) {
+            if (state.maxHealth[unit] <= 0 || state.maxHealth[unit] > 65535 || state.startMana[unit] > 65535) return false;
+            for (int defender = 0; defender < state.unitCount; ++defender) {
+                if (sideOf(defender) == sideOf(unit)) continue;
+                if (state.hit(unit, defender, CombatState::AttackHit) + state.hit(unit, defender, CombatState::PotentialHit) <= 0) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    ExactResult solve() {
+        ExactResult result;
+        if (!supported()) return result;
+        int health[MaxUnits], mana[MaxUnits];
+        copy(state.maxHealth.begin(), state.maxHealth.end(), health);
+        copy(state.startMana.begin(), state.startMana.end(), mana);
+        double probability = value(health, mana, 0);
+        result.states = static_cast<long long>(memo.size());
+        if (overflow) return result;
+        result.solved = true;
+        result.probability = probability;
+        return result;
+    }
+};
+
+ExactResult solveExact(const CombatState& state, size_t stateLimit = ExactStateLimit) {
+    ExactSolver solver(state, stateLimit);
+    return solver.solve();
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LAB1_X86_DISPATCH 1
+#define LAB1_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define LAB1_X86_DISPATCH 0
+#define LAB1_ALWAYS_INLINE inline
+#endif
+
+enum class SimdLevel { Scalar, Avx2, Avx512 };
+
+// Lockstep lanes scan every defender per attack, which beats the tournament trees only for small groups;
+// a 1v1 round is so short that the scalar loop wins outright.
+const int LaneMinUnits = 3;
+const int LaneMaxUnits = 64;
+
+// Plays rounds [firstRound, firstRound + rounds) one per lane: all lanes take the same (side, attacker) step
+// together and every per-lane value lives at [unit * Lanes + lane], so each step is a plain loop over lanes
+// that the compiler turns into vector code. Rounds use the same random bits as playRound, so results match.
+template <int Lanes>
+LAB1_ALWAYS_INLINE RoundTally playRoundsInLanes(const CombatState& initial, long long firstRound, long long rounds, uint64_t seed) {
+    const int units = initial.unitCount;
+    const int sideBegin[2] = { 0, initial.group1Size };
+    const int sideEnd[2] = { initial.group1Size, initial.unitCount };
+    vector<int> health(static_cast<size_t>(units) * Lanes), mana(static_cast<size_t>(units) * Lanes);
+    vector<BattleRng> rng(Lanes, BattleRng(seed));
+    alignas(64) int active[Lanes] = {};
+    alignas(64) int acting[Lanes];
+    alignas(64) int bestKey[Lanes];
+    alignas(64) int best[Lanes];
+    alignas(64) int flip[Lanes] = {};
+    alignas(64) int flipped[Lanes];
+    alignas(64) int cast[Lanes];
+    long long nextRound = 0;
+    RoundTally tally;
+
+    while (true) {
+        int running = 0;
+        for (int l = 0; l < Lanes; ++l) {
+            if (!active[l] && nextRound < rounds) {
+                for (int u = 0; u < units; ++u) {
+                    health[u * Lanes + l] = initial.maxHealth[u];
+                    mana[u * Lanes + l] = initial.startMana[u];
+                }
+                rng[l].startRound(static_cast<uint64_t>(firstRound + nextRound++));
+                active[l] = 1;
+            }
+            running += active[l];
+        }
+        if (running == 0) break;
+
+        for (int side = 0; side < 2; ++side) {
+            const FocusStrategy strategy = initial.strategy[side];
+            const bool byHealth = strategy == FocusStrategy::LowestHP || strategy == FocusStrategy::HighestHP;
+            const bool preferHigher = strategy == FocusStrategy::HighestHP || strategy == FocusStrategy::HighestDamage;
+            const int defenderBegin = sideBegin[1 - side];
+            const int defenderEnd = sideEnd[1 - side];
+
+            for (int attacker = sideBegin[side]; attacker < sideEnd[side]; ++attacker) {
+                int* attackerHealth = &health[attacker * Lanes];
+                int anyActing = 0;
+                for (int l = 0; l < Lanes; ++l) {
+                    acting[l] = active[l] & (attackerHealth[l] > 0);
+                    anyActing |= acting[l];
+                }
+                if (!anyActing) continue;
+
+                for (int l = 0; l < Lanes; ++l) {
+                    bestKey[l] = INT32_MAX;
+                    best[l] = -1;
+                }
+                // key = healthSign * health + fixedKey, so "prefer higher" becomes a minimum over negated values.
+                const int healthSign = byHealth ? (preferHigher ? -1 : 1) : 0;
+                for (int d = defenderBegin; d < defenderEnd; ++d) {
+                    const int* h = &health[d * Lanes];
+                    const int fixedKey = byHealth ? 0 : (preferHigher ? -initial.damagePotential[d] : initial.damagePotential[d]);
+                    for (int l = 0; l < Lanes; ++l) {
+                        int key = healthSign * h[l] + fixedKey;
+                        int take = (h[l] > 0) & (key < bestKey[l]);
+                        bestKey[l] = take ? key : bestKey[l];
+                        best[l] = take ? d : best[l];
+                    }
+                }
+
+                int finished = 0;
+                for (int l = 0; l < Lanes; ++l) {
+                    int won = acting[l] & (best[l] < 0);
+                    finished += won;
+                    active[l] &= ~won;
+                    acting[l] &= ~won;
+                }
+                if (side == 0) tally.group1Wins += finished;
+                else tally.group2Wins += finished;
+
+                const int hasSpell = initial.hasSpell[attacker];
+                for (int l = 0; l < Lanes; ++l) {
+                    flipped[l] = 0;
+                    cast[l] = 0;
+                }
+                if (hasSpell) {
+                    for (int l = 0; l < Lanes; ++l) {
+                        flip[l] = acting[l] ? rng[l].peekFlip() : 0;
+                    }
+                }
+
+                const int cost = initial.spellCost[attacker];
+                int* attackerMana = &mana[attacker * Lanes];
+                for (int d = defenderBegin; d < defenderEnd; ++d) {
+                    const int attackHits = initial.hit(attacker, d, CombatState::AttackHit) + initial.hit(attacker, d, CombatState::PotentialHit);
+                    const int spellHits = 2 * initial.hit(attacker, d, CombatState::SpellHit);
+                    int* h = &health[d * Lanes];
+                    for (int l = 0; l < Lanes; ++l) {
+                        int targeted = acting[l] & (best[l] == d);
+                        int after = max(h[l] - attackHits, 0);
+                        int wantsFlip = targeted & (after > 0) & hasSpell;
+                        int casts = wantsFlip & flip[l] & (attackerMana[l] >= cost);
+                        after = casts ? max(after - spellHits, 0) : after;
+                        h[l] = targeted ? after : h[l];
+                        flipped[l] |= wantsFlip;
+                        cast[l] |= casts;
+                    }
+                }
+                for (int l = 0; l < Lanes; ++l) {
+                    attackerMana[l] -= cast[l] ? cost : 0;
+                }
+                if (hasSpell) {
+                    for (int l = 0; l < Lanes; ++l) {
+                        rng[l].skip(static_cast<uint64_t>(flipped[l]));
+                    }
+                }
+            }
+        }
+    }
+    return tally;
+}
+
+#if LAB1_X86_DISPATCH
+__attribute__((target("avx2"))) RoundTally playRoundsAvx2(const CombatState& initial, long long firstRound, long long rounds, uint64_t seed) {
+    return playRoundsInLanes<8>(initial, firstRound, rounds, seed);
+}
+
+__attribute__((target("avx512f"))) RoundTally playRoundsAvx512(const CombatState& initial, long long firstRound, long long rounds, uint64_t seed) {
+    return playRoundsInLanes<16>(initial, firstRound, rounds, seed);
+}
+#endif
+
+SimdLevel detectSimdLevel() {
+#if LAB1_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SimdLevel::Avx512;
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::Avx2;
+#endif
+    return SimdLevel::Scalar;
+}
+
+// The widest engine the rounds may use; lowered by --simd, never raised above what the CPU supports.
+SimdLevel& simdLimit() {
+    static SimdLevel limit = detectSimdLevel();
+    return limit;
+}
+
+SimdLevel simdLevelFor(const CombatState& initial) {
+    bool fits = !initial.positional && initial.spellPolicy == SpellPolicy::First && initial.unitCount >= LaneMinUnits && initial.unitCount <= LaneMaxUnits;
+    return fits ? simdLimit() : SimdLevel::Scalar;
+}
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::Avx2: return "avx2";
+        case SimdLevel::Avx512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+// With stats set or profiling on, rounds go through the scalar engine so every hit can be observed.
+void playRoundBlock(const CombatState& initial, long long firstRound, long long rounds, uint64_t seed, RoundTally& tally,
+                    BattleStats* stats) {
+    if (stats) {
+        CombatState state = initial;
+        BattleRng rng(seed);
+        StatsEventSink sink(*stats, state.unitCount);
+        RoundFunction play = roundFunctionFor(state);
+        RoundTally local;
+        for (long long i = 0; i < rounds; ++i) {
+            rng.startRound(static_cast<uint64_t>(firstRound + i));
+            int winner = play(state, rng, &sink);
+            sink.endRound(state, winner);
+            if (winner == 1) local.group1Wins++;
+            else local.group2Wins++;
+        }
+        tally = local;
+        return;
+    }
+#if LAB1_X86_DISPATCH
+    switch (profilingEnabled() ? SimdLevel::Scalar : simdLevelFor(initial)) {
+        case SimdLevel::Avx512: tally = playRoundsAvx512(initial, firstRound, rounds, seed); return;
+        case SimdLevel::Avx2: tally = playRoundsAvx2(initial, firstRound, rounds, seed); return;
+        default: break;
+    }
+#endif
+    CombatState state = initial;
+    BattleRng rng(seed);
+    RoundFunction play = roundFunctionFor(state);
+    RoundTally local;
+
+    for (long long i = 0; i < rounds; ++i) {
+        rng.startRound(static_cast<uint64_t>(firstRound + i));
+        if (play(state, rng, nullptr) == 1) {
+            local.group1Wins++;
+        } else {
+            local.group2Wins++;
+        }
+    }
+
+    tally = local;
+}
+
+void runRoundBlock(const CombatState& initial, long long firstRound, long long rounds, uint64_t seed, RoundTally& tally,
+                   BattleStats* stats = nullptr) {
+    {
+        TraceScope span("rounds", rounds);
+        playRoundBlock(initial, firstRound, rounds, seed, tally, stats);
+    }
+    profileFlush();
+}
+
+// Plays rounds [firstRound, firstRound + rounds); the totals do not depend on the thread count.
+RoundTally runRoundsParallel(const CombatState& initial, long long rounds, uint64_t seed, int threads, long long firstRound = 0,
+                             BattleStats* stats = nullptr) {
+    if (threads < 1) threads = 1;
+    if (rounds < threads) threads = static_cast<int>(max(1LL, rounds));
+
+    vector<RoundTally> tallies(threads);
+    vector<BattleStats> workerStats(stats ? threads : 0);
+    vector<thread> workers;
+    workers.reserve(threads);
+
+    for (int w = 0; w < threads; ++w) {
+        long long begin = rounds * w / threads;
+        long long end = rounds * (w + 1) / threads;
+        BattleStats* part = nullptr;
+        if (stats) {
+            part = &workerStats[w];
+            part->reset(initial.unitCount);
+        }
+        workers.emplace_back(runRoundBlock, cref(initial), firstRound + begin, end - begin, seed, ref(tallies[w]), part);
+    }
+
+    RoundTally total;
+    for (int w = 0; w < threads; ++w) {
+        workers[w].join();
+        total.group1Wins += tallies[w].group1Wins;
+        total.group2Wins += tallies[w].group2Wins;
+        if (stats) stats->merge(workerStats[w]);
+    }
+    return total;
+}
+
+int defaultThreadCount() {
+    unsigned int cores = thread::hardware_concurrency();
+    return cores == 0 ? 1 : static_cast<int>(cores);
+}
+
+double normalQuantile(double p) {
+    double low = -10.0, high = 10.0;
+    for (int i = 0; i < 100; ++i) {
+        double mid = (low + high) / 2;
+        if (0.5 * erfc(-mid / sqrt(2.0)) < p) low = mid;
+        else high = mid;
+    }
+    return (low + high) / 2;
+}
+
+double confidenceToZ(double confidence) {
+    return normalQuantile(1 - (1 - confidence) / 2);
+}
+
+// Runs parallel batches until the Wilson interval for group 1 is no wider than +-halfWidth.
+// Batches continue the round numbering, so the result depends only on (seed, threads, halfWidth, z).
+long long preciseMinBatch(int threads) { return max(256LL, 64LL * threads); }
+
+// The batch schedule of a precision run: how many rounds to play after the first `done`, or 0 once the interval is
+// narrow enough or maxRounds are played. It only looks at whole batches, so a seed always gives the same tally.
+// Without a precision (halfWidth 0) the rest is one batch.
+long long nextPreciseBatch(const RoundTally& total, long long done, double halfWidth, double z, long long maxRounds,
+                           long long minBatch) {
+    if (done >= maxRounds) return 0;
+    if (halfWidth <= 0) return maxRounds - done;
+    long long batch = minBatch;
+    if (done > 0) {
+        WinInterval interval = wilsonInterval(total.group1Wins, done, z);
+        if ((interval.upper - interval.lower) / 2 <= halfWidth) return 0;
+
+        double p = min(max(interval.estimate, 1.0 / done), 1 - 1.0 / done);
+        long long needed = static_cast<long long>(ceil(z * z * p * (1 - p) / (halfWidth * halfWidth)));
+        batch = min(max(needed - done, minBatch), done);
+    }
+    return min(batch, maxRounds - done);
+}
+
+RoundTally runUntilPrecise(const CombatState& initial, double halfWidth, double z, long long maxRounds, uint64_t seed, int threads,
+                           BattleStats* stats = nullptr) {
+    const long long minBatch = preciseMinBatch(threads);
+    RoundTally total;
+    long long done = 0;
+
+    while (long long batch = nextPreciseBatch(total, done, halfWidth, z, maxRounds, minBatch)) {
+        RoundTally part = runRoundsParallel(initial, batch, seed, threads, done, stats);
+        total.group1Wins += part.group1Wins;
+        total.group2Wins += part.group2Wins;
+        done += batch;
+    }
+    return total;
+}
+
+void assignUnitIds(vector<Character*>& group1, vector<Character*>& group2) {
+    int id = 0;
+    for (Character* c : group1) c->setId(id++);
+    for (Character* c : group2) c->setId(id++);
+}
+
+void battleSimulation(BattleGraph& graph, vector<Character*>& group1, vector<Character*>& group2, FocusStrategy strategy,
+                      int rounds, bool showLog, uint64_t seed, int threads) {
+    RoundTally total;
+    assignUnitIds(group1, group2);
+    CombatState initial = CombatState::build(group1, group2, strategy, strategy);
+
+    if (showLog) {
+        CombatState state = initial;
+        LogEventSink sink(group1, group2);
+        BattleRng rng(seed);
+
+        for (int i = 0; i < rounds; ++i) {
+            rng.startRound(i);
+            cout << "\nRound " << i + 1 << " - Target Focus:" << endl;
+            graph.createEdgesBasedOnCriteria(group1, group2, strategy);
+            graph.displayGraph();
+
+            if (playRound(state, rng, &sink) == 1) {
+                total.group1Wins++;
+            } else {
+                total.group2Wins++;
+            }
+        }
+        profileFlush();
+
+        threads = 1;
+    } else {
+        total = runRoundsParallel(initial, rounds, seed, threads);
+    }
+
+    cout << "\nResults after " << rounds << " rounds (seed " << seed << ", " << threads << " thread(s)):\n";
+    cout << "Group 1 won: " << total.group1Wins << " time(s).\n";
+    cout << "Group 2 won: " << total.group2Wins << " time(s).\n";
+    double probGroup1Win = static_cast<double>(total.group1Wins) / rounds * 100;
+    double probGroup2Win = static_cast<double>(total.group2Wins) / rounds * 100;
+    WinInterval interval = wilsonInterval(total.group1Wins, rounds, confidenceToZ(0.95));
+    cout << "Group 1 win probability: " << probGroup1Win << "% (95% CI " << interval.lower * 100 << "% - " << interval.upper * 100 << "%)\n";
+    cout << "Group 2 win probability: " << probGroup2Win << "% (95% CI " << (1 - interval.upper) * 100 << "% - " << (1 - interval.lower) * 100 << "%)\n";
+}
+
+FocusStrategy chooseFocusStrategy() {
+    cout << "Choose criteria for characters to foccus their attck on:\n";
+    cout << "1. Least HP\n";
+    cout << "2. Most HP\n";
+    cout << "3. least Damage\n";
+    cout << "4. Most Damage\n";
+    int choice;
+    cin >> choice;
+    switch (choice) {
+        case 1: return FocusStrategy::LowestHP;
+        case 2: return FocusStrategy::HighestHP;
+        case 3: return FocusStrategy::LowestDamage;
+        case 4: return FocusStrategy::HighestDamage;
+        default: 
+            cout << "Invalid choice. Retutned to default (lowest HP)\n";
+            return FocusStrategy::LowestHP;
+    }
+}
+
+void mainMenu() {
+    BattleArena arena;
     BattleGraph graph;
     vector<Character*> group1, group2;
 
-    int choice;
-    FocusStrategy strategy = FocusStrategy::LowestHP;
+    int choice;
+    FocusStrategy strategy = FocusStrategy::LowestHP;
+
+    cout << "Welcome to the Battle Simulation!\n";
+    cout << "You can create characters for 2 groups and simulate battles between them!\n";
+    
+    do {
+        cout << "\nMain Menu:\n";
+        cout << "1. Create character for Group 1\n";
+        cout << "2. Create character for Group 2\n";
+        cout << "3. Display all characters\n";
+        cout << "4. Set up and run battle simulation\n";
+        cout << "5. Choose strategy\n";
+        cout << "6. Show focus graph spanning tree\n";
+        cout << "7. Exit\n";
+        choice = getValidatedInput("Enter your choice: ", 1, 7);
+
+        switch (choice) {
+            case 1: {
+                cout << "\nCreating character for Group 1...\n";
+                Character* newCharacter = createCharacter(arena);
+                if (newCharacter) {
+                    group1.push_back(newCharacter);
+                }
+                break;
+            }
+            case 2: {
+                cout << "\nCreating character for Group 2...\n";
+                Character* newCharacter = createCharacter(arena);
+                if (newCharacter) {
+                    group2.push_back(newCharacter);
+                }
+                break;
+            }
+            case 3: {
+                cout << "\nDisplaying all characters:\n";
+                cout << "\n--- Group 1 ---\n";
+                for (const Character* character : group1) {
+                    character->display();
+                    cout << endl;
+                }
+                cout << "\n--- Group 2 ---\n";
+                for (const Character* character : group2) {
+                    character->display();
+                    cout << endl;
+                }
+                break;
+            }
+            case 4: {
+                if (group1.empty() || group2.empty()) {
+                    cout << "Both groups must have at least one character to start the battle!\n";
+                } else {
+                    int rounds = getValidatedInput("Enter the number of rounds for the battle: ", 1, numeric_limits<int>::max());
+                    int logChoice = getValidatedInput("Do you want a detailed battle log? (1 for Yes, 0 for No): ", 0, 1);
+                    bool showLog = logChoice == 1;
+                    int seedChoice = getValidatedInput("Enter a seed for the battle (0 for random): ", 0, numeric_limits<int>::max());
+                    uint64_t seed = seedChoice == 0 ? randomSeed() : static_cast<uint64_t>(seedChoice);
+                    battleSimulation(graph, group1, group2, strategy, rounds, showLog, seed, defaultThreadCount());
+                }
+                break;
+            }
+            case 5:
+                strategy = chooseFocusStrategy();
+                break;
+            case 6: {
+                graph.createEdgesBasedOnCriteria(group1, group2, strategy);
+                graph.displayGraph();
+                int maximum = getValidatedInput("Build minimum (0) or maximum (1) threat spanning tree? ", 0, 1);
+                graph.displaySpanningTree(maximum == 1);
+                break;
+            }
+            case 7:
+                cout << "Exiting the program. Goodbye!\n";
+                break;
+        }
+    } while (choice != 7);
+}
+
+// Read-only view of a whole file: mmap where available, otherwise one read into memory.
+class MappedFile {
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+    vector<char> buffer;
+#if LAB1_HAS_MMAP
+    void* mapping = nullptr;
+#endif
+
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#if LAB1_HAS_MMAP
+        if (mapping) munmap(mapping, length);
+#endif
+    }
+
+    bool open(const string& path, string& error) {
+#if LAB1_HAS_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0) {
+            if (fd >= 0) close(fd);
+            error = "cannot open " + path;
+            return false;
+        }
+        length = static_cast<size_t>(info.st_size);
+        if (length > 0) {
+            mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) mapping = nullptr;
+        }
+        close(fd);
+        if (length > 0 && !mapping) {
+            error = "cannot map " + path;
+            return false;
+        }
+        bytes = static_cast<const char*>(mapping);
+        return true;
+#else
+        ifstream in(path, ios::binary);
+        if (!in) {
+            error = "cannot open " + path;
+            return false;
+        }
+        buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        bytes = buffer.data();
+        length = buffer.size();
+        return true;
+#endif
+    }
+
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+// Container used by roster and result files: header, column directory, then each column 64-byte aligned in
+// host byte order, so a mapped file is used in place and loading a column is a single copy.
+struct ColumnFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t columnCount;
+    uint64_t meta[4];
+};
+
+struct ColumnEntry {
+    uint32_t id;
+    uint32_t elementSize;
+    uint64_t offset;
+    uint64_t count;
+};
+
+class ColumnFileWriter {
+private:
+    struct Pending {
+        uint32_t id;
+        uint32_t elementSize;
+        const void* data;
+        uint64_t count;
+    };
+
+    ColumnFileHeader header = {};
+    vector<Pending> columns;
+
+public:
+    ColumnFileWriter(const char* magic, uint32_t version) {
+        copy(magic, magic + 8, header.magic);
+        header.version = version;
+    }
+
+    void setMeta(int index, uint64_t value) { header.meta[index] = value; }
+
+    // The data must stay alive until write().
+    template <typename T>
+    void add(uint32_t id, const T* data, size_t count) {
+        static_assert(is_trivially_copyable<T>::value, "columns must be trivially copyable");
+        columns.push_back({ id, static_cast<uint32_t>(sizeof(T)), data, count });
+    }
+
+    bool write(const string& path, string& error) {
+        header.columnCount = static_cast<uint32_t>(columns.size());
+        vector<ColumnEntry> entries;
+        uint64_t offset = sizeof(ColumnFileHeader) + columns.size() * sizeof(ColumnEntry);
+        for (const Pending& column : columns) {
+            offset = (offset + 63) & ~63ULL;
+            entries.push_back({ column.id, column.elementSize, offset, column.count });
+            offset += column.count * column.elementSize;
+        }
+
+        string temporary = path + ".tmp";
+        {
+            ofstream out(temporary, ios::binary | ios::trunc);
+            if (!out) {
+                error = "cannot write " + temporary;
+                return false;
+            }
+            writeBinary(out, header);
+            for (const ColumnEntry& entry : entries) writeBinary(out, entry);
+            for (size_t i = 0; i < columns.size(); ++i) {
+                static const char padding[64] = {};
+                out.write(padding, static_cast<streamsize>(entries[i].offset - static_cast<uint64_t>(out.tellp())));
+                out.write(static_cast<const char*>(columns[i].data), static_cast<streamsize>(columns[i].count * columns[i].elementSize));
+            }
+            if (!out.flush()) {
+                error = "cannot write " + temporary;
+                return false;
+            }
+        }
+        if (rename(temporary.c_str(), path.c_str()) != 0) {
+            error = "cannot replace " + path;
+            return false;
+        }
+        return true;
+    }
+};
+
+class ColumnFile {
+private:
+    MappedFile file;
+    const ColumnFileHeader* header = nullptr;
+    const ColumnEntry* entries = nullptr;
+
+public:
+    bool open(const string& path, const char* magic, uint32_t version, string& error) {
+        if (!file.open(path, error)) return false;
+        header = reinterpret_cast<const ColumnFileHeader*>(file.data());
+        if (file.size() < sizeof(ColumnFileHeader) || !equal(magic, magic + 8, header->magic) || header->version != version) {
+            error = path + " is not a version " + to_string(version) + " " + string(magic, 8) + " file";
+            return false;
+        }
+        entries = reinterpret_cast<const ColumnEntry*>(file.data() + sizeof(ColumnFileHeader));
+        if (header->columnCount > (file.size() - sizeof(ColumnFileHeader)) / sizeof(ColumnEntry)) {
+            error = path + " is truncated";
+            return false;
+        }
+        for (uint32_t i = 0; i < header->columnCount; ++i) {
+            const ColumnEntry& entry = entries[i];
+            // Written as divisions so that a corrupt count or offset cannot wrap around.
+            if (entry.offset % 64 != 0 || entry.elementSize == 0 || entry.offset > file.size() ||
+                entry.count > (file.size() - entry.offset) / entry.elementSize) {
+                error = path + " is truncated";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint64_t meta(int index) const { return header->meta[index]; }
+
+    // Points into the mapping; nullptr when the column is missing or has another element type.
+    template <typename T>
+    const T* column(uint32_t id, uint64_t& count) const {
+        for (uint32_t i = 0; i < header->columnCount; ++i) {
+            if (entries[i].id == id && entries[i].elementSize == sizeof(T)) {
+                count = entries[i].count;
+                return reinterpret_cast<const T*>(file.data() + entries[i].offset);
+            }
+        }
+        count = 0;
+        return nullptr;
+    }
+};
+
+template <typename T>
+bool columnEquals(const ColumnFile& file, uint32_t id, const vector<T>& expected) {
+    uint64_t count = 0;
+    const T* data = file.column<T>(id, count);
+    return data && count == expected.size() && equal(expected.begin(), expected.end(), data);
+}
+
+template <typename T>
+bool copyColumn(const ColumnFile& file, uint32_t id, size_t expected, vector<T>& out) {
+    uint64_t count = 0;
+    const T* data = file.column<T>(id, count);
+    if (!data || (expected != SIZE_MAX && count != expected)) return false;
+    out.assign(data, data + count);
+    return true;
+}
+
+// Roster files: both groups' units as CombatState columns plus what is needed to rebuild the Characters.
+// meta[0] and meta[1] hold the group sizes.
+const char RosterMagic[9] = "LAB1RSTR";
+const uint32_t RosterVersion = 1;
+
+enum RosterColumn : uint32_t {
+    RosterClass, RosterLevel, RosterWeapon, RosterArmor, RosterMaxHealth, RosterMana, RosterAttackDamage,
+    RosterDamagePotential, RosterSpellDamage, RosterSpellCost, RosterHasSpell, RosterArmorKind,
+    RosterArmorKindFactor, RosterHitDamage, RosterNameEnd, RosterNames
+};
+
+int equipmentIndex(const vector<pair<string, int>>& list, const string& name, int bonus) {
+    for (size_t i = 0; i < list.size(); ++i) {
+        if (list[i].first == name && list[i].second == bonus) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+bool saveRoster(const string& path, const vector<Character*>& group1, const vector<Character*>& group2, string& error) {
+    CombatState state = CombatState::build(group1, group2, FocusStrategy::LowestHP, FocusStrategy::LowestHP);
+    vector<unsigned char> classes;
+    vector<int> levels, weapons, armors;
+    vector<uint64_t> nameEnd;
+    string names;
+    for (int side = 0; side < 2; ++side) {
+        for (const Character* c : side == 0 ? group1 : group2) {
+            classes.push_back(static_cast<unsigned char>(c->getCharacterClass()));
+            levels.push_back(c->getLevel());
+            const Weapon* weapon = c->getWeapon();
+            const Armor* armor = c->getArmor();
+            weapons.push_back(weapon ? equipmentIndex(Weapon::getWeaponList(), weapon->getName(), weapon->getDamageBonus()) : -1);
+            armors.push_back(armor ? equipmentIndex(Armor::getArmorList(), armor->getName(), armor->getDefenseBonus()) : -1);
+            names += c->getName();
+            nameEnd.push_back(names.size());
+        }
+    }
+
+    ColumnFileWriter writer(RosterMagic, RosterVersion);
+    writer.setMeta(0, group1.size());
+    writer.setMeta(1, group2.size());
+    writer.add(RosterClass, classes.data(), classes.size());
+    writer.add(RosterLevel, levels.data(), levels.size());
+    writer.add(RosterWeapon, weapons.data(), weapons.size());
+    writer.add(RosterArmor, armors.data(), armors.size());
+    writer.add(RosterMaxHealth, state.maxHealth.data(), state.maxHealth.size());
+    writer.add(RosterMana, state.startMana.data(), state.startMana.size());
+    writer.add(RosterAttackDamage, state.attackDamage.data(), state.attackDamage.size());
+    writer.add(RosterDamagePotential, state.damagePotential.data(), state.damagePotential.size());
+    writer.add(RosterSpellDamage, state.spellDamage.data(), state.spellDamage.size());
+    writer.add(RosterSpellCost, state.spellCost.data(), state.spellCost.size());
+    writer.add(RosterHasSpell, state.hasSpell.data(), state.hasSpell.size());
+    writer.add(RosterArmorKind, state.armorKind.data(), state.armorKind.size());
+    writer.add(RosterArmorKindFactor, state.armorKindFactor.data(), state.armorKindFactor.size());
+    writer.add(RosterHitDamage, state.hitDamage.data(), state.hitDamage.size());
+    writer.add(RosterNameEnd, nameEnd.data(), nameEnd.size());
+    writer.add(RosterNames, names.data(), names.size());
+    return writer.write(path, error);
+}
+
+// Fills every CombatState column with one copy from the mapped file; no per-unit work besides the target trees.
+// The roster must have passed validateRoster().
+bool loadRosterState(const ColumnFile& roster, FocusStrategy strategy1, FocusStrategy strategy2, CombatState& state) {
+    state = CombatState();
+    state.group1Size = static_cast<int>(roster.meta(0));
+    state.unitCount = static_cast<int>(roster.meta(0) + roster.meta(1));
+    state.strategy[0] = strategy1;
+    state.strategy[1] = strategy2;
+    size_t units = static_cast<size_t>(state.unitCount);
+    bool ok = copyColumn(roster, RosterMaxHealth, units, state.maxHealth) && copyColumn(roster, RosterMana, units, state.startMana) &&
+              copyColumn(roster, RosterAttackDamage, units, state.attackDamage) &&
+              copyColumn(roster, RosterDamagePotential, units, state.damagePotential) &&
+              copyColumn(roster, RosterSpellDamage, units, state.spellDamage) && copyColumn(roster, RosterSpellCost, units, state.spellCost) &&
+              copyColumn(roster, RosterHasSpell, units, state.hasSpell) && copyColumn(roster, RosterArmorKind, units, state.armorKind) &&
+              copyColumn(roster, RosterArmorKindFactor, SIZE_MAX, state.armorKindFactor) &&
+              copyColumn(roster, RosterHitDamage, units * state.armorKindFactor.size() * CombatState::HitKindCount, state.hitDamage);
+    uint64_t classCount = 0, levelCount = 0;
+    const unsigned char* classes = roster.column<unsigned char>(RosterClass, classCount);
+    const int* levels = roster.column<int>(RosterLevel, levelCount);
+    if (!ok || !classes || !levels || classCount != units || levelCount != units) return false;
+    for (size_t i = 0; i < units; ++i) {
+        CharacterClass characterClass = static_cast<CharacterClass>(classes[i]);
+        int ids[SpellsPerClass];
+        for (int slot = 0; slot < SpellsPerClass; ++slot) ids[slot] = state.hasSpell[i] ? spellIdOf(characterClass, slot) : -1;
+        state.range.push_back(attackRange(characterClass));
+        state.addSpellBook(ids, levels[i]);
+    }
+    state.buildSpellHitTable();
+    state.health = state.maxHealth;
+    state.mana = state.startMana;
+    state.alive.resize(units);
+    for (size_t i = 0; i < units; ++i) state.alive[i] = state.health[i] > 0;
+    state.initTargets();
+    return true;
+}
+
+string rosterUnitName(const ColumnFile& roster, int unit) {
+    uint64_t count = 0, nameBytes = 0;
+    const uint64_t* nameEnd = roster.column<uint64_t>(RosterNameEnd, count);
+    const char* names = roster.column<char>(RosterNames, nameBytes);
+    if (!nameEnd || !names || static_cast<uint64_t>(unit) >= count) return "unit-" + to_string(unit + 1);
+    uint64_t begin = unit == 0 ? 0 : nameEnd[unit - 1];
+    return string(names + begin, names + nameEnd[unit]);
+}
+
+// Creates real Characters for the roster, for the paths that need them (logs, replay, the optimizer).
+bool materializeRoster(const ColumnFile& roster, BattleArena& arena, vector<Character*>& group1, vector<Character*>& group2) {
+    uint64_t count = 0;
+    const unsigned char* classes = roster.column<unsigned char>(RosterClass, count);
+    const int* levels = roster.column<int>(RosterLevel, count);
+    const int* weapons = roster.column<int>(RosterWeapon, count);
+    const int* armors = roster.column<int>(RosterArmor, count);
+    uint64_t units = roster.meta(0) + roster.meta(1);
+    if (!classes || !levels || !weapons || !armors || count != units) return false;
+
+    const auto& weaponList = Weapon::getWeaponList();
+    const auto& armorList = Armor::getArmorList();
+    vector<Weapon*> weaponObjects(weaponList.size(), nullptr);
+    vector<Armor*> armorObjects(armorList.size(), nullptr);
+    for (uint64_t i = 0; i < units; ++i) {
+        Weapon* weapon = nullptr;
+        Armor* armor = nullptr;
+        if (weapons[i] >= 0 && weapons[i] < static_cast<int>(weaponList.size())) {
+            if (!weaponObjects[weapons[i]]) {
+                weaponObjects[weapons[i]] = arena.create<Weapon>(weaponList[weapons[i]].first.c_str(), weaponList[weapons[i]].second);
+            }
+            weapon = weaponObjects[weapons[i]];
+        }
+        if (armors[i] >= 0 && armors[i] < static_cast<int>(armorList.size())) {
+            if (!armorObjects[armors[i]]) {
+                armorObjects[armors[i]] = arena.create<Armor>(armorList[armors[i]].first.c_str(), armorList[armors[i]].second);
+            }
+            armor = armorObjects[armors[i]];
+        }
+        Character* c = createCharacterOfClass(arena, static_cast<CharacterClass>(classes[i]), rosterUnitName(roster, static_cast<int>(i)),
+                                              levels[i], weapon, armor);
+        (i < roster.meta(0) ? group1 : group2).push_back(c);
+    }
+    return true;
+}
+
+// Checks everything the loaders above index with, once when the roster is opened, so they can trust the columns.
+bool validateRoster(const ColumnFile& roster, string& error) {
+    uint64_t group1 = roster.meta(0), group2 = roster.meta(1);
+    uint64_t maxUnits = static_cast<uint64_t>(numeric_limits<int>::max());
+    if (group1 > maxUnits || group2 > maxUnits - group1) {
+        error = "group sizes are out of range";
+        return false;
+    }
+    uint64_t units = group1 + group2;
+    uint64_t count = 0;
+    const char* intColumns[] = { "level", "weapon", "armor", "max health", "mana", "attack damage", "damage potential",
+                                 "spell damage", "spell cost" };
+    const RosterColumn intIds[] = { RosterLevel, RosterWeapon, RosterArmor, RosterMaxHealth, RosterMana, RosterAttackDamage,
+                                    RosterDamagePotential, RosterSpellDamage, RosterSpellCost };
+    for (size_t i = 0; i < sizeof(intIds) / sizeof(intIds[0]); ++i) {
+        if (!roster.column<int>(intIds[i], count) || count != units) {
+            error = string(intColumns[i]) + " column does not match the group sizes";
+            return false;
+        }
+    }
+    const unsigned char* classes = roster.column<unsigned char>(RosterClass, count);
+    if (!classes || count != units) {
+        error = "class column does not match the group sizes";
+        return false;
+    }
+    if (!roster.column<unsigned char>(RosterHasSpell, count) || count != units) {
+        error = "spell column does not match the group sizes";
+        return false;
+    }
+    const unsigned char* armorKind = roster.column<unsigned char>(RosterArmorKind, count);
+    if (!armorKind || count != units) {
+        error = "armor kind column does not match the group sizes";
+        return false;
+    }
+    uint64_t kinds = 0, hitCount = 0;
+    // Armor kinds are stored as bytes.
+    if (!roster.column<double>(RosterArmorKindFactor, kinds) || kinds == 0 || kinds > 256) {
+        error = "armor kind factor column is corrupt";
+        return false;
+    }
+    if (!roster.column<int>(RosterHitDamage, hitCount) || hitCount != units * kinds * CombatState::HitKindCount) {
+        error = "hit damage column does not match the group sizes";
+        return false;
+    }
+    uint64_t nameBytes = 0;
+    const uint64_t* nameEnd = roster.column<uint64_t>(RosterNameEnd, count);
+    if (!nameEnd || count != units || !roster.column<char>(RosterNames, nameBytes)) {
+        error = "name columns do not match the group sizes";
+        return false;
+    }
+
+    const int* levels = roster.column<int>(RosterLevel, count);
+    const int* weapons = roster.column<int>(RosterWeapon, count);
+    const int* armors = roster.column<int>(RosterArmor, count);
+    int weaponCount = static_cast<int>(Weapon::getWeaponList().size());
+    int armorCount = static_cast<int>(Armor::getArmorList().size());
+    for (uint64_t i = 0; i < units; ++i) {
+        bool ok = classes[i] <= static_cast<unsigned char>(CharacterClass::Mage) && levels[i] >= 1 && levels[i] <= MaxLevel &&
+                  weapons[i] >= -1 && weapons[i] < weaponCount && armors[i] >= -1 && armors[i] < armorCount && armorKind[i] < kinds &&
+                  nameEnd[i] >= (i == 0 ? 0 : nameEnd[i - 1]) && nameEnd[i] <= nameBytes;
+        if (!ok) {
+            error = "unit " + to_string(i + 1) + " is corrupt";
+            return false;
+        }
+    }
+
+    // The combat columns must be exactly what each unit's class, level and equipment give. Otherwise the fast
+    // path would play another matchup than replays, sweeps and the optimizer, which rebuild the Characters, and
+    // a zero hit could keep a round going forever.
+    BattleArena arena;
+    vector<Character*> rebuilt[2];
+    materializeRoster(roster, arena, rebuilt[0], rebuilt[1]);
+    CombatState expected = CombatState::build(rebuilt[0], rebuilt[1], FocusStrategy::LowestHP, FocusStrategy::LowestHP);
+    bool ok = columnEquals(roster, RosterMaxHealth, expected.maxHealth) && columnEquals(roster, RosterMana, expected.startMana) &&
+              columnEquals(roster, RosterAttackDamage, expected.attackDamage) &&
+              columnEquals(roster, RosterDamagePotential, expected.damagePotential) &&
+              columnEquals(roster, RosterSpellDamage, expected.spellDamage) && columnEquals(roster, RosterSpellCost, expected.spellCost) &&
+              columnEquals(roster, RosterHasSpell, expected.hasSpell) && columnEquals(roster, RosterArmorKind, expected.armorKind) &&
+              columnEquals(roster, RosterArmorKindFactor, expected.armorKindFactor) &&
+              columnEquals(roster, RosterHitDamage, expected.hitDamage);
+    if (!ok) {
+        error = "combat columns do not match the units' class, level and equipment";
+        return false;
+    }
+    return true;
+}
+
+// Result tables: one row per simulated cell. meta[0..3] give the cube dimensions when the rows form one
+// (all zero for a flat list of batch results).
+const char ResultMagic[9] = "LAB1RSLT";
+const uint32_t ResultVersion = 1;
+
+enum ResultColumn : uint32_t {
+    ResultScenarioHash, ResultSeed, ResultRounds, ResultGroup1Wins, ResultGroup2Wins, ResultLower, ResultUpper, ResultAxes
+};
+
+enum class SweepAxisKind : int { Level, Equipment, Strategy };
+
+// One dimension of a sweep cube: `count` values of a group-wide parameter. Equipment values index the
+// weapon x armor pairs (weapon = value / armor count, armor = value % armor count).
+struct SweepAxis {
+    SweepAxisKind kind;
+    int group;
+    int from;
+    int step;
+    int count;
+
+    int value(int index) const { return from + index * step; }
+};
+
+const int MaxSweepAxes = 4;
+// Every cell is a full simulation and a result row, so larger cubes are almost certainly typos.
+const uint64_t MaxSweepCells = 1000000;
+
+// Checks an axis read from a file; parsed axes are built valid.
+bool validSweepAxis(const SweepAxis& axis) {
+    if ((axis.group != 1 && axis.group != 2) || axis.count < 1) return false;
+    switch (axis.kind) {
+        case SweepAxisKind::Level:
+            return axis.from >= 1 && axis.from <= MaxLevel && axis.step >= 1 && axis.count <= MaxLevel &&
+                   axis.value(axis.count - 1) <= MaxLevel;
+        case SweepAxisKind::Equipment:
+            return axis.from == 0 && axis.step == 1 &&
+                   axis.count == static_cast<int>(Weapon::getWeaponList().size() * Armor::getArmorList().size());
+        case SweepAxisKind::Strategy:
+            return axis.from == 0 && axis.step == 1 && axis.count == 4;
+    }
+    return false;
+}
+
+struct Scenario {
+    string source;
+    long long rounds = 1000;
+    bool hasRounds = false;
+    double precision = 0.0;
+    double confidence = 0.95;
+    uint64_t seed = 0;
+    bool hasSeed = false;
+    int threads = 0;
+    int teamSize = 0;
+    int levelCap = 100;
+    FocusStrategy strategy[2] = { FocusStrategy::LowestHP, FocusStrategy::LowestHP };
+    vector<SweepAxis> sweep;
+    double decided = 0.01;
+    bool positional = false;
+    float spacing = 1.0f;
+    float gap = 10.0f;
+    SpellPolicy spellPolicy = SpellPolicy::First;
+    string text;
+    vector<Character*> group1;
+    vector<Character*> group2;
+    BattleArena arena;
+    unique_ptr<ColumnFile> roster;
+};
+
+int scenarioGroupSize(const Scenario& scenario, int side) {
+    if (scenario.roster) return static_cast<int>(scenario.roster->meta(side));
+    return static_cast<int>(side == 0 ? scenario.group1.size() : scenario.group2.size());
+}
+
+string scenarioUnitName(const Scenario& scenario, int unit) {
+    if (scenario.roster) return rosterUnitName(*scenario.roster, unit);
+    int group1Size = static_cast<int>(scenario.group1.size());
+    return unit < group1Size ? scenario.group1[unit]->getName() : scenario.group2[unit - group1Size]->getName();
+}
+
+// False when the scenario's roster file does not hold the units its header promises.
+bool scenarioState(const Scenario& scenario, CombatState& state) {
+    if (scenario.roster) {
+        if (!loadRosterState(*scenario.roster, scenario.strategy[0], scenario.strategy[1], state)) return false;
+    } else {
+        state = CombatState::build(scenario.group1, scenario.group2, scenario.strategy[0], scenario.strategy[1]);
+    }
+    if (scenario.positional) state.deploy(scenario.spacing, scenario.gap);
+    state.spellPolicy = scenario.spellPolicy;
+    return true;
+}
+
+// Roster-backed scenarios only get Characters when something needs them.
+bool materializeScenario(Scenario& scenario) {
+    if (scenario.roster && scenario.group1.empty() && scenario.group2.empty()) {
+        if (!materializeRoster(*scenario.roster, scenario.arena, scenario.group1, scenario.group2)) {
+            scenario.group1.clear();
+            scenario.group2.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+const char* const BadRosterError = "the roster file does not match its group sizes";
+
+string normalizeToken(const string& token) {
+    string normalized = token;
+    for (char& ch : normalized) {
+        if (ch == '_' || ch == ' ') ch = '-';
+        else ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+    }
+    return normalized;
+}
+
+bool parseFocusStrategy(const string& token, FocusStrategy& strategy) {
+    string t = normalizeToken(token);
+    if (t == "1" || t == "lowest-hp") strategy = FocusStrategy::LowestHP;
+    else if (t == "2" || t == "highest-hp") strategy = FocusStrategy::HighestHP;
+    else if (t == "3" || t == "lowest-damage") strategy = FocusStrategy::LowestDamage;
+    else if (t == "4" || t == "highest-damage") strategy = FocusStrategy::HighestDamage;
+    else return false;
+    return true;
+}
+
+bool parseSpellPolicy(const string& token, SpellPolicy& policy) {
+    string t = normalizeToken(token);
+    if (t == "first") policy = SpellPolicy::First;
+    else if (t == "strongest") policy = SpellPolicy::Strongest;
+    else if (t == "weighted") policy = SpellPolicy::Weighted;
+    else return false;
+    return true;
+}
+
+bool parseCharacterClass(const string& token, CharacterClass& characterClass) {
+    string t = normalizeToken(token);
+    if (t == "warrior") characterClass = CharacterClass::Warrior;
+    else if (t == "archer") characterClass = CharacterClass::Archer;
+    else if (t == "mage") characterClass = CharacterClass::Mage;
+    else return false;
+    return true;
+}
+
+// Accepts "none"/0, a 1-based index into the list or the item name with spaces written as '-'.
+int parseEquipmentIndex(const vector<pair<string, int>>& list, const string& token) {
+    string t = normalizeToken(token);
+    if (t == "none" || t == "0") return -1;
+    for (size_t i = 0; i < list.size(); ++i) {
+        if (t == to_string(i + 1) || t == normalizeToken(list[i].first)) return static_cast<int>(i);
+    }
+    return -2;
+}
+
+bool parseScenario(istream& in, Scenario& scenario, string& error) {
+    Weapon* weapons[8] = {};
+    Armor* armors[8] = {};
+    string line;
+    int lineNumber = 0;
+
+    while (getline(in, line)) {
+        lineNumber++;
+        size_t comment = line.find('#');
+        if (comment != string::npos) line.erase(comment);
+
+        istringstream fields(line);
+        string key;
+        if (!(fields >> key)) continue;
+        key = normalizeToken(key);
+
+        bool ok = true;
+        if (key == "rounds") {
+            ok = static_cast<bool>(fields >> scenario.rounds) && scenario.rounds > 0;
+            scenario.hasRounds = true;
+        } else if (key == "precision") {
+            ok = static_cast<bool>(fields >> scenario.precision) && scenario.precision > 0 && scenario.precision < 0.5;
+        } else if (key == "confidence") {
+            ok = static_cast<bool>(fields >> scenario.confidence) && scenario.confidence > 0 && scenario.confidence < 1;
+        } else if (key == "seed") {
+            ok = static_cast<bool>(fields >> scenario.seed);
+            scenario.hasSeed = true;
+        } else if (key == "threads") {
+            ok = static_cast<bool>(fields >> scenario.threads) && scenario.threads >= 0;
+        } else if (key == "team-size") {
+            ok = static_cast<bool>(fields >> scenario.teamSize) && scenario.teamSize >= 1;
+        } else if (key == "level-cap") {
+            ok = static_cast<bool>(fields >> scenario.levelCap) && scenario.levelCap >= 1 && scenario.levelCap <= MaxLevel;
+        } else if (key == "strategy") {
+            int group = 0;
+            string value;
+            ok = (fields >> group >> value) && (group == 1 || group == 2) && parseFocusStrategy(value, scenario.strategy[group - 1]);
+        } else if (key == "sweep") {
+            SweepAxis axis = { SweepAxisKind::Level, 0, 0, 1, 0 };
+            string kind;
+            ok = (fields >> kind >> axis.group) && (axis.group == 1 || axis.group == 2) && scenario.sweep.size() < MaxSweepAxes;
+            kind = normalizeToken(kind);
+            if (ok && kind == "level") {
+                int to = 0;
+                ok = static_cast<bool>(fields >> axis.from >> to) && axis.from >= 1 && to >= axis.from && to <= MaxLevel;
+                if (!(fields >> axis.step)) axis.step = 1;
+                ok = ok && axis.step >= 1;
+                axis.count = ok ? (to - axis.from) / axis.step + 1 : 0;
+            } else if (ok && kind == "equipment") {
+                axis.kind = SweepAxisKind::Equipment;
+                axis.count = static_cast<int>(Weapon::getWeaponList().size() * Armor::getArmorList().size());
+            } else if (ok && kind == "strategy") {
+                axis.kind = SweepAxisKind::Strategy;
+                axis.count = 4;
+            } else {
+                ok = false;
+            }
+            if (ok) {
+                uint64_t cells = 1;
+                for (const SweepAxis& other : scenario.sweep) cells *= static_cast<uint64_t>(other.count);
+                if (cells * static_cast<uint64_t>(axis.count) > MaxSweepCells) {
+                    error = "line " + to_string(lineNumber) + ": the sweep has more than " + to_string(MaxSweepCells) + " cells";
+                    return false;
+                }
+                scenario.sweep.push_back(axis);
+            }
+        } else if (key == "positional") {
+            scenario.positional = true;
+            if (fields >> scenario.spacing) fields >> scenario.gap;
+            ok = scenario.spacing > 0 && scenario.gap >= 0;
+        } else if (key == "spells") {
+            string policy;
+            ok = static_cast<bool>(fields >> policy) && parseSpellPolicy(policy, scenario.spellPolicy);
+        } else if (key == "decided") {
+            ok = static_cast<bool>(fields >> scenario.decided) && scenario.decided >= 0 && scenario.decided < 0.5;
+        } else if (key == "roster") {
+            string path;
+            ok = static_cast<bool>(fields >> path) && !scenario.roster && scenario.group1.empty() && scenario.group2.empty();
+            if (ok) {
+                scenario.roster.reset(new ColumnFile());
+                string rosterError;
+                if (!scenario.roster->open(path, RosterMagic, RosterVersion, rosterError)) {
+                    error = "line " + to_string(lineNumber) + ": " + rosterError;
+                    return false;
+                }
+                if (!validateRoster(*scenario.roster, rosterError)) {
+                    error = "line " + to_string(lineNumber) + ": " + path + ": " + rosterError;
+                    return false;
+                }
+            }
+        } else if (key == "unit") {
+            int group = 0, level = 0;
+            string classToken, weaponToken = "none", armorToken = "none", name;
+            CharacterClass characterClass;
+            ok = (fields >> group >> classToken >> level) && (group == 1 || group == 2) && level >= 1 && level <= MaxLevel &&
+                 parseCharacterClass(classToken, characterClass) && !scenario.roster;
+            fields >> weaponToken >> armorToken >> name;
+
+            int weaponIndex = parseEquipmentIndex(Weapon::getWeaponList(), weaponToken);
+            int armorIndex = parseEquipmentIndex(Armor::getArmorList(), armorToken);
+            ok = ok && weaponIndex != -2 && armorIndex != -2;
+
+            if (ok) {
+                vector<Character*>& target = group == 1 ? scenario.group1 : scenario.group2;
+                if (weaponIndex >= 0 && !weapons[weaponIndex]) {
+                    const auto& entry = Weapon::getWeaponList()[weaponIndex];
+                    weapons[weaponIndex] = scenario.arena.create<Weapon>(entry.first.c_str(), entry.second);
+                }
+                if (armorIndex >= 0 && !armors[armorIndex]) {
+                    const auto& entry = Armor::getArmorList()[armorIndex];
+                    armors[armorIndex] = scenario.arena.create<Armor>(entry.first.c_str(), entry.second);
+                }
+                if (name.empty()) {
+                    name = "g" + to_string(group) + "-" + normalizeToken(classToken) + "-" + to_string(target.size() + 1);
+                }
+                target.push_back(createCharacterOfClass(scenario.arena, characterClass, name, level,
+                                                        weaponIndex >= 0 ? weapons[weaponIndex] : nullptr,
+                                                        armorIndex >= 0 ? armors[armorIndex] : nullptr));
+            }
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            error = "line " + to_string(lineNumber) + ": cannot parse '" + line + "'";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Keeps the scenario's text, so it can be shipped to worker processes as is.
+bool loadScenario(const string& path, Scenario& scenario, string& error) {
+    scenario.source = path;
+    ostringstream text;
+    if (path == "-") {
+        text << cin.rdbuf();
+    } else {
+        ifstream file(path);
+        if (!file) {
+            error = "cannot open file";
+            return false;
+        }
+        text << file.rdbuf();
+    }
+    scenario.text = text.str();
+    istringstream in(scenario.text);
+    return parseScenario(in, scenario, error);
+}
+
+string jsonEscape(const string& text) {
+    string escaped;
+    for (char ch : text) {
+        if (ch == '"' || ch == '\\') escaped += '\\';
+        escaped += ch;
+    }
+    return escaped;
+}
+
+enum class OutputFormat {
+    Json,
+    Csv
+};
+
+void writeStatsJson(ostream& out, const Scenario& scenario, const BattleStats& stats) {
+    int lastTurn = BattleStats::TurnBuckets - 1;
+    while (lastTurn > 0 && stats.turnHistogram.counts[lastTurn] == 0) lastTurn--;
+
+    out << "{\"turns\":{\"mean\":" << stats.turns.mean << ",\"stdev\":" << sqrt(stats.turns.variance())
+        << ",\"min\":" << stats.turns.minimum << ",\"max\":" << stats.turns.maximum
+        << ",\"p50\":" << stats.turnQuantile(0.5) << ",\"p90\":" << stats.turnQuantile(0.9)
+        << ",\"p99\":" << stats.turnQuantile(0.99) << ",\"histogram\":[";
+    for (int i = 0; i <= lastTurn; ++i) out << (i ? "," : "") << stats.turnHistogram.counts[i];
+    out << "]}";
+    for (int side = 0; side < 2; ++side) {
+        const RunningMoments& survivors = stats.winnerSurvivors[side];
+        out << ",\"group" << side + 1 << "Survivors\":{\"wins\":" << survivors.count << ",\"mean\":" << survivors.mean
+            << ",\"stdev\":" << sqrt(survivors.variance()) << "}";
+    }
+    out << ",\"units\":[";
+    int unit = 0;
+    for (int side = 0; side < 2; ++side) {
+        for (int member = 0; member < scenarioGroupSize(scenario, side); ++member) {
+            const RunningMoments& damage = stats.damageDealt[unit];
+            double rounds = static_cast<double>(max(1LL, stats.rounds));
+            out << (unit ? "," : "") << "{\"group\":" << side + 1 << ",\"name\":\"" << jsonEscape(scenarioUnitName(scenario, unit))
+                << "\",\"damageMean\":" << damage.mean << ",\"damageStdev\":" << sqrt(damage.variance())
+                << ",\"damageMax\":" << damage.maximum << ",\"spellCasts\":" << stats.spellCasts[unit]
+                << ",\"castsPerRound\":" << stats.spellCasts[unit] / rounds
+                << ",\"manaExhaustedRate\":" << stats.manaExhaustedRounds[unit] / rounds << "}";
+            unit++;
+        }
+    }
+    out << "]}";
+}
+
+// With `exact` set, the record also carries the exact probability and, if rounds were played, how many
+// standard errors the estimate is off from it. A solved run with no rounds reports the exact values alone.
+void writeBatchResult(ostream& out, OutputFormat format, const Scenario& scenario, uint64_t seed, int threads,
+                      const RoundTally& tally, double seconds, const BattleStats* stats = nullptr, const ExactResult* exact = nullptr) {
+    long long roundsUsed = tally.group1Wins + tally.group2Wins;
+    double rounds = static_cast<double>(roundsUsed);
+    WinInterval interval = wilsonInterval(tally.group1Wins, roundsUsed, confidenceToZ(scenario.confidence));
+    double group1Probability = tally.group1Wins / rounds, group2Probability = tally.group2Wins / rounds;
+    bool solved = exact && exact->solved;
+    double deviation = 0.0;
+    if (solved && roundsUsed == 0) {
+        group1Probability = exact->probability;
+        group2Probability = 1.0 - exact->probability;
+        interval = { exact->probability, exact->probability, exact->probability };
+    } else if (solved) {
+        double error = sqrt(exact->probability * (1.0 - exact->probability) / rounds);
+        deviation = error > 0 ? (group1Probability - exact->probability) / error : (group1Probability == exact->probability ? 0.0 : INFINITY);
+    }
+    if (format == OutputFormat::Csv) {
+        out << scenario.source << ',' << scenarioGroupSize(scenario, 0) << ',' << scenarioGroupSize(scenario, 1) << ','
+            << roundsUsed << ',' << seed << ',' << threads << ',' << tally.group1Wins << ',' << tally.group2Wins << ','
+            << group1Probability << ',' << group2Probability << ',' << scenario.confidence << ','
+            << interval.lower << ',' << interval.upper << ',' << seconds;
+        if (stats) {
+            out << ',' << stats->turns.mean << ',' << stats->turnQuantile(0.5) << ',' << stats->turnQuantile(0.9)
+                << ',' << stats->turnQuantile(0.99) << ',' << stats->winnerSurvivors[0].mean << ',' << stats->winnerSurvivors[1].mean;
+        }
+        if (exact) {
+            out << ',';
+            if (solved) out << exact->probability;
+            out << ',';
+            if (solved && roundsUsed > 0) out << deviation;
+        }
+        out << '\n';
+    } else {
+        out << "{\"scenario\":\"" << jsonEscape(scenario.source) << "\",\"group1Size\":" << scenarioGroupSize(scenario, 0)
+            << ",\"group2Size\":" << scenarioGroupSize(scenario, 1) << ",\"rounds\":" << roundsUsed << ",\"seed\":" << seed
+            << ",\"threads\":" << threads << ",\"group1Wins\":" << tally.group1Wins << ",\"group2Wins\":" << tally.group2Wins
+            << ",\"group1WinProbability\":" << group1Probability << ",\"group2WinProbability\":" << group2Probability
+            << ",\"confidence\":" << scenario.confidence << ",\"group1WinLower\":" << interval.lower
+            << ",\"group1WinUpper\":" << interval.upper << ",\"seconds\":" << seconds;
+        if (stats) {
+            out << ",\"stats\":";
+            writeStatsJson(out, scenario, *stats);
+        }
+        if (exact) {
+            out << ",\"exact\":";
+            if (solved) {
+                out << "{\"probability\":" << exact->probability << ",\"states\":" << exact->states;
+                if (roundsUsed > 0) out << ",\"deviation\":" << deviation;
+                out << "}";
+            } else {
+                out << "null";
+            }
+        }
+        out << "}\n";
+    }
+}
+
+const char* focusStrategyName(FocusStrategy strategy) {
+    switch (strategy) {
+        case FocusStrategy::LowestHP: return "lowest-hp";
+        case FocusStrategy::HighestHP: return "highest-hp";
+        case FocusStrategy::LowestDamage: return "lowest-damage";
+        case FocusStrategy::HighestDamage: return "highest-damage";
+    }
+    return "lowest-hp";
+}
+
+const char* characterClassName(CharacterClass characterClass) {
+    switch (characterClass) {
+        case CharacterClass::Warrior: return "warrior";
+        case CharacterClass::Archer: return "archer";
+        case CharacterClass::Mage: return "mage";
+    }
+    return "warrior";
+}
+
+string equipmentToken(const vector<pair<string, int>>& list, int index) {
+    return index < 0 ? "none" : normalizeToken(list[index].first);
+}
+
+struct ResultTable {
+    uint64_t dims[4] = { 0, 0, 0, 0 };
+    vector<uint64_t> scenarioHash;
+    vector<uint64_t> seed;
+    vector<long long> rounds;
+    vector<long long> group1Wins;
+    vector<long long> group2Wins;
+    vector<double> lower;
+    vector<double> upper;
+    vector<SweepAxis> axes;
+
+    size_t size() const { return scenarioHash.size(); }
+
+    void resize(size_t rows) {
+        scenarioHash.resize(rows);
+        seed.resize(rows);
+        rounds.resize(rows);
+        group1Wins.resize(rows);
+        group2Wins.resize(rows);
+        lower.resize(rows);
+        upper.resize(rows);
+    }
+
+    void set(size_t row, uint64_t hash, uint64_t rowSeed, const RoundTally& tally, const WinInterval& interval) {
+        scenarioHash[row] = hash;
+        seed[row] = rowSeed;
+        rounds[row] = tally.group1Wins + tally.group2Wins;
+        group1Wins[row] = tally.group1Wins;
+        group2Wins[row] = tally.group2Wins;
+        lower[row] = interval.lower;
+        upper[row] = interval.upper;
+    }
+
+    void add(uint64_t hash, uint64_t rowSeed, const RoundTally& tally, const WinInterval& interval) {
+        resize(size() + 1);
+        set(size() - 1, hash, rowSeed, tally, interval);
+    }
+
+    bool save(const string& path, string& error) const {
+        ColumnFileWriter writer(ResultMagic, ResultVersion);
+        for (int i = 0; i < 4; ++i) writer.setMeta(i, dims[i]);
+        writer.add(ResultScenarioHash, scenarioHash.data(), size());
+        writer.add(ResultSeed, seed.data(), size());
+        writer.add(ResultRounds, rounds.data(), size());
+        writer.add(ResultGroup1Wins, group1Wins.data(), size());
+        writer.add(ResultGroup2Wins, group2Wins.data(), size());
+        writer.add(ResultLower, lower.data(), size());
+        writer.add(ResultUpper, upper.data(), size());
+        if (!axes.empty()) writer.add(ResultAxes, axes.data(), axes.size());
+        return writer.write(path, error);
+    }
+
+    bool load(const string& path, string& error) {
+        ColumnFile file;
+        if (!file.open(path, ResultMagic, ResultVersion, error)) return false;
+        for (int i = 0; i < 4; ++i) dims[i] = file.meta(i);
+        uint64_t rows = 0;
+        file.column<uint64_t>(ResultScenarioHash, rows);
+        if (!copyColumn(file, ResultScenarioHash, rows, scenarioHash) || !copyColumn(file, ResultSeed, rows, seed) ||
+            !copyColumn(file, ResultRounds, rows, rounds) || !copyColumn(file, ResultGroup1Wins, rows, group1Wins) ||
+            !copyColumn(file, ResultGroup2Wins, rows, group2Wins) || !copyColumn(file, ResultLower, rows, lower) ||
+            !copyColumn(file, ResultUpper, rows, upper)) {
+            error = path + " is missing result columns";
+            return false;
+        }
+        uint64_t axisCount = 0;
+        const SweepAxis* axisData = file.column<SweepAxis>(ResultAxes, axisCount);
+        axes.assign(axisData, axisData + axisCount);
+        // A cube's axes must span exactly its rows; writeCsv decodes every row through them.
+        bool ok = axisCount <= MaxSweepAxes;
+        uint64_t cells = 1;
+        for (size_t i = 0; ok && i < 4; ++i) {
+            if (i < axes.size()) {
+                ok = validSweepAxis(axes[i]) && dims[i] == static_cast<uint64_t>(axes[i].count);
+                cells *= dims[i];
+            } else {
+                ok = dims[i] == 0;
+            }
+        }
+        if (!ok || (!axes.empty() && cells != rows)) {
+            error = path + " has a corrupt sweep layout";
+            return false;
+        }
+        return true;
+    }
+
+    // Cube rows are row-major with the first axis slowest; each axis adds its decoded value columns.
+    void writeCsv(ostream& out) const {
+        const auto& armorList = Armor::getArmorList();
+        out << "row";
+        for (const SweepAxis& axis : axes) {
+            string group = to_string(axis.group);
+            if (axis.kind == SweepAxisKind::Level) out << ",level" << group;
+            else if (axis.kind == SweepAxisKind::Equipment) out << ",weapon" << group << ",armor" << group;
+            else out << ",strategy" << group;
+        }
+        out << ",scenarioHash,seed,rounds,group1Wins,group2Wins,group1WinLower,group1WinUpper\n";
+        for (size_t i = 0; i < size(); ++i) {
+            out << i;
+            size_t stride = size();
+            for (const SweepAxis& axis : axes) {
+                stride /= max(1, axis.count);
+                int value = axis.value(static_cast<int>(i / stride % axis.count));
+                if (axis.kind == SweepAxisKind::Level) out << ',' << value;
+                else if (axis.kind == SweepAxisKind::Equipment) {
+                    int armorCount = static_cast<int>(armorList.size());
+                    out << ',' << equipmentToken(Weapon::getWeaponList(), value / armorCount) << ',' << equipmentToken(armorList, value % armorCount);
+                } else out << ',' << focusStrategyName(static_cast<FocusStrategy>(value));
+            }
+            out << ',' << scenarioHash[i] << ',' << seed[i] << ',' << rounds[i] << ',' << group1Wins[i] << ','
+                << group2Wins[i] << ',' << lower[i] << ',' << upper[i] << '\n';
+        }
+    }
+};
+
+struct BuildUnit {
+    CharacterClass characterClass;
+    int level;
+    int weapon;
+    int armor;
+};
+
+struct Build {
+    vector<BuildUnit> units;
+    FocusStrategy strategy = FocusStrategy::LowestHP;
+
+    string key() const {
+        vector<string> parts;
+        for (const BuildUnit& u : units) {
+            parts.push_back(to_string(static_cast<int>(u.characterClass)) + ":" + to_string(u.level) + ":" +
+                            to_string(u.weapon) + ":" + to_string(u.armor));
+        }
+        sort(parts.begin(), parts.end());
+        string result = to_string(static_cast<int>(strategy));
+        for (const string& part : parts) result += "|" + part;
+        return result;
+    }
+};
+
+struct BuildScore {
+    long long wins = 0;
+    long long rounds = 0;
+    bool pruned = false;
+
+    WinInterval interval(double z) const { return wilsonInterval(wins, rounds, z); }
+};
+
+struct OptimizerSettings {
+    int teamSize = 3;
+    int levelCap = 100;
+    long long batchRounds = 256;
+    long long maxRounds = 4096;
+    int maxGenerations = 50;
+    double z = 1.96;
+    uint64_t seed = 1;
+    int threads = 1;
+};
+
+class EquipmentCatalog {
+private:
+    BattleArena arena;
+    vector<Weapon*> weapons;
+    vector<Armor*> armors;
+
+public:
+    EquipmentCatalog() {
+        for (const auto& entry : Weapon::getWeaponList()) weapons.push_back(arena.create<Weapon>(entry.first.c_str(), entry.second));
+        for (const auto& entry : Armor::getArmorList()) armors.push_back(arena.create<Armor>(entry.first.c_str(), entry.second));
+    }
+
+    Weapon* weapon(int index) const { return index < 0 ? nullptr : weapons[index]; }
+    Armor* armor(int index) const { return index < 0 ? nullptr : armors[index]; }
+};
+
+BuildScore evaluateBuild(const Build& build, const vector<Character*>& opponents, FocusStrategy opponentStrategy,
+                         const EquipmentCatalog& catalog, const OptimizerSettings& settings,
+                         bool hasIncumbent, const WinInterval& incumbent) {
+    BattleArena arena;
+    vector<Character*> team;
+    for (size_t i = 0; i < build.units.size(); ++i) {
+        const BuildUnit& u = build.units[i];
+        team.push_back(createCharacterOfClass(arena, u.characterClass, "unit-" + to_string(i + 1), u.level,
+                                              catalog.weapon(u.weapon), catalog.armor(u.armor)));
+    }
+
+    CombatState state = CombatState::build(team, opponents, build.strategy, opponentStrategy);
+    arena.release();
+
+    // Every candidate sees the same random stream, so score differences come from the build, not the dice.
+    BuildScore score;
+    while (score.rounds < settings.maxRounds) {
+        long long batch = min(settings.batchRounds, settings.maxRounds - score.rounds);
+        RoundTally part;
+        runRoundBlock(state, score.rounds, batch, settings.seed, part);
+        score.wins += part.group1Wins;
+        score.rounds += batch;
+
+        if (hasIncumbent && score.interval(settings.z).upper < incumbent.lower) {
+            score.pruned = true;
+            break;
+        }
+    }
+    return score;
+}
+
+vector<Build> neighbourBuilds(const Build& build, const OptimizerSettings& settings) {
+    vector<Build> result;
+    const int weaponCount = static_cast<int>(Weapon::getWeaponList().size());
+    const int armorCount = static_cast<int>(Armor::getArmorList().size());
+    const CharacterClass classes[] = { CharacterClass::Warrior, CharacterClass::Archer, CharacterClass::Mage };
+
+    for (size_t i = 0; i < build.units.size(); ++i) {
+        const BuildUnit& unit = build.units[i];
+        for (CharacterClass c : classes) {
+            if (c == unit.characterClass) continue;
+            Build next = build;
+            next.units[i].characterClass = c;
+            result.push_back(next);
+        }
+        for (int w = -1; w < weaponCount; ++w) {
+            if (w == unit.weapon) continue;
+            Build next = build;
+            next.units[i].weapon = w;
+            result.push_back(next);
+        }
+        for (int a = -1; a < armorCount; ++a) {
+            if (a == unit.armor) continue;
+            Build next = build;
+            next.units[i].armor = a;
+            result.push_back(next);
+        }
+        for (int step : { -10, -1, 1, 10 }) {
+            int level = unit.level + step;
+            if (level < 1 || level > settings.levelCap) continue;
+            Build next = build;
+            next.units[i].level = level;
+            result.push_back(next);
+        }
+    }
+    for (int s = 0; s < 4; ++s) {
+        FocusStrategy strategy = static_cast<FocusStrategy>(s);
+        if (strategy == build.strategy) continue;
+        Build next = build;
+        next.strategy = strategy;
+        result.push_back(next);
+    }
+    return result;
+}
+
+struct OptimizerResult {
+    Build best;
+    BuildScore bestScore;
+    long long evaluated = 0;
+    long long pruned = 0;
+    long long cacheHits = 0;
+    long long roundsSimulated = 0;
+    int generations = 0;
+};
+
+// Steepest-ascent local search over single-attribute changes. Each generation scores all uncached
+// neighbours in parallel and drops the ones whose Wilson upper bound falls below the incumbent.
+OptimizerResult optimizeBuild(const vector<Character*>& opponents, FocusStrategy opponentStrategy, const OptimizerSettings& settings) {
+    EquipmentCatalog catalog;
+    map<string, BuildScore> cache;
+    OptimizerResult result;
+
+    mt19937_64 random(settings.seed);
+    Build current;
+    current.strategy = static_cast<FocusStrategy>(random() % 4);
+    for (int i = 0; i < settings.teamSize; ++i) {
+        current.units.push_back({ static_cast<CharacterClass>(random() % 3), settings.levelCap,
+                                  static_cast<int>(random() % Weapon::getWeaponList().size()),
+                                  static_cast<int>(random() % Armor::getArmorList().size()) });
+    }
+
+    WinInterval none = { 0.0, 0.0, 1.0 };
+    BuildScore currentScore = evaluateBuild(current, opponents, opponentStrategy, catalog, settings, false, none);
+    cache[current.key()] = currentScore;
+    result.evaluated++;
+    result.roundsSimulated += currentScore.rounds;
+
+    for (int generation = 0; generation < settings.maxGenerations; ++generation) {
+        result.generations = generation + 1;
+        WinInterval incumbent = currentScore.interval(settings.z);
+
+        vector<Build> candidates;
+        vector<BuildScore> scores;
+        for (Build& b : neighbourBuilds(current, settings)) {
+            auto cached = cache.find(b.key());
+            if (cached != cache.end()) {
+                result.cacheHits++;
+                continue;
+            }
+            candidates.push_back(b);
+        }
+        scores.resize(candidates.size());
+
+        atomic<size_t> next(0);
+        auto worker = [&]() {
+            for (size_t i = next++; i < candidates.size(); i = next++) {
+                scores[i] = evaluateBuild(candidates[i], opponents, opponentStrategy, catalog, settings, true, incumbent);
+            }
+        };
+        vector<thread> workers;
+        int threads = max(1, min(settings.threads, static_cast<int>(candidates.size())));
+        for (int t = 0; t < threads; ++t) workers.emplace_back(worker);
+        for (thread& t : workers) t.join();
+
+        int bestIndex = -1;
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            cache[candidates[i].key()] = scores[i];
+            result.evaluated++;
+            result.roundsSimulated += scores[i].rounds;
+            if (scores[i].pruned) {
+                result.pruned++;
+                continue;
+            }
+            long long bestWins = bestIndex < 0 ? currentScore.wins : scores[bestIndex].wins;
+            if (scores[i].wins > bestWins) bestIndex = static_cast<int>(i);
+        }
+
+        if (bestIndex < 0) break;
+        current = candidates[bestIndex];
+        currentScore = scores[bestIndex];
+    }
+
+    result.best = current;
+    result.bestScore = currentScore;
+    return result;
+}
+
+void writeOptimizerResult(ostream& out, const Scenario& scenario, const OptimizerSettings& settings,
+                          const OptimizerResult& result, double seconds) {
+    WinInterval interval = result.bestScore.interval(settings.z);
+    out << "{\"scenario\":\"" << jsonEscape(scenario.source) << "\",\"teamSize\":" << settings.teamSize
+        << ",\"levelCap\":" << settings.levelCap << ",\"seed\":" << settings.seed
+        << ",\"strategy\":\"" << focusStrategyName(result.best.strategy) << "\",\"units\":[";
+    for (size_t i = 0; i < result.best.units.size(); ++i) {
+        const BuildUnit& u = result.best.units[i];
+        out << (i ? "," : "") << "{\"class\":\"" << characterClassName(u.characterClass) << "\",\"level\":" << u.level
+            << ",\"weapon\":\"" << equipmentToken(Weapon::getWeaponList(), u.weapon)
+            << "\",\"armor\":\"" << equipmentToken(Armor::getArmorList(), u.armor) << "\"}";
+    }
+    out << "],\"winProbability\":" << interval.estimate << ",\"lower\":" << interval.lower << ",\"upper\":" << interval.upper
+        << ",\"rounds\":" << result.bestScore.rounds << ",\"generations\":" << result.generations
+        << ",\"evaluated\":" << result.evaluated << ",\"pruned\":" << result.pruned << ",\"cacheHits\":" << result.cacheHits
+        << ",\"roundsSimulated\":" << result.roundsSimulated << ",\"seconds\":" << seconds << "}\n";
+}
+
+// Profiles for every class x level x weapon x armor a sweep can reach, built once through setStatsByClass
+// and then shared read-only by all sweep threads instead of creating Characters per cell.
+class UnitProfileTable {
+private:
+    int maxLevel;
+    int weaponCount;
+    int armorCount;
+    vector<UnitProfile> profiles;
+
+    size_t index(CharacterClass characterClass, int level, int weapon, int armor) const {
+        size_t slot = static_cast<size_t>(characterClass) * maxLevel + (level - 1);
+        return (slot * (weaponCount + 1) + (weapon + 1)) * (armorCount + 1) + (armor + 1);
+    }
+
+public:
+    explicit UnitProfileTable(int maxLevel)
+        : maxLevel(maxLevel), weaponCount(static_cast<int>(Weapon::getWeaponList().size())),
+          armorCount(static_cast<int>(Armor::getArmorList().size())) {
+        const CharacterClass classes[] = { CharacterClass::Warrior, CharacterClass::Archer, CharacterClass::Mage };
+        EquipmentCatalog catalog;
+        profiles.resize(3 * static_cast<size_t>(maxLevel) * (weaponCount + 1) * (armorCount + 1));
+        for (CharacterClass c : classes) {
+            for (int level = 1; level <= maxLevel; ++level) {
+                for (int weapon = -1; weapon < weaponCount; ++weapon) {
+                    for (int armor = -1; armor < armorCount; ++armor) {
+                        BattleArena arena;
+                        Character* unit = createCharacterOfClass(arena, c, "", level, catalog.weapon(weapon), catalog.armor(armor));
+                        profiles[index(c, level, weapon, armor)] = UnitProfile::of(unit);
+                    }
+                }
+            }
+        }
+    }
+
+    const UnitProfile& get(const BuildUnit& unit) const {
+        return profiles[index(unit.characterClass, unit.level, unit.weapon, unit.armor)];
+    }
+};
+
+// Runs task(i, worker) for every i < taskCount. Each worker owns a deque seeded with a contiguous slice and
+// works from its front; an idle worker steals from the back of the fullest other deque. Cells that exit
+// early leave their owner idle sooner, which is what the stealing evens out.
+template <typename Task>
+void runWorkStealing(size_t taskCount, int threads, const Task& task) {
+    struct WorkQueue {
+        mutex lock;
+        deque<size_t> tasks;
+    };
+    threads = max(1, min(threads, static_cast<int>(max<size_t>(1, taskCount))));
+    vector<WorkQueue> queues(threads);
+    for (int t = 0; t < threads; ++t) {
+        size_t begin = taskCount * t / threads, end = taskCount * (t + 1) / threads;
+        for (size_t i = begin; i < end; ++i) queues[t].tasks.push_back(i);
+    }
+
+    auto worker = [&](int self) {
+        while (true) {
+            size_t next = 0;
+            bool found = false;
+            {
+                lock_guard<mutex> guard(queues[self].lock);
+                if (!queues[self].tasks.empty()) {
+                    next = queues[self].tasks.front();
+                    queues[self].tasks.pop_front();
+                    found = true;
+                }
+            }
+            if (!found) {
+                int victim = -1;
+                size_t victimSize = 0;
+                for (int t = 0; t < threads; ++t) {
+                    if (t == self) continue;
+                    lock_guard<mutex> guard(queues[t].lock);
+                    if (queues[t].tasks.size() > victimSize) {
+                        victim = t;
+                        victimSize = queues[t].tasks.size();
+                    }
+                }
+                if (victim < 0) return;
+                lock_guard<mutex> guard(queues[victim].lock);
+                if (queues[victim].tasks.empty()) continue;
+                next = queues[victim].tasks.back();
+                queues[victim].tasks.pop_back();
+            }
+            task(next, self);
+        }
+    };
+
+    vector<thread> workers;
+    for (int t = 1; t < threads; ++t) workers.emplace_back(worker, t);
+    worker(0);
+    for (thread& t : workers) t.join();
+}
+
+struct SweepSettings {
+    long long rounds = 1000;
+    bool positional = false;
+    float spacing = 1.0f;
+    float gap = 10.0f;
+    SpellPolicy spellPolicy = SpellPolicy::First;
+    long long batchRounds = 256;
+    double precision = 0.0;
+    double decided = 0.01;
+    double z = 1.96;
+    uint64_t seed = 1;
+    int threads = 1;
+};
+
+struct SweepSummary {
+    long long cells = 0;
+    long long decidedEarly = 0;
+    long long roundsSimulated = 0;
+};
+
+// Simulates every cell of the cube spanned by `axes` around the base groups and fills a dense result table.
+// All cells replay the same rounds of the same seed, so neighbouring cells differ only by their parameters.
+// A cell stops after any batch that leaves its Wilson interval entirely within `decided` of 0 or 1, or
+// (with a precision) narrower than +-precision.
+SweepSummary runSweep(const vector<BuildUnit> base[2], const FocusStrategy baseStrategy[2], const vector<SweepAxis>& axes,
+                      const SweepSettings& settings, ResultTable& results) {
+    int maxLevel = 1;
+    for (int side = 0; side < 2; ++side) {
+        for (const BuildUnit& unit : base[side]) maxLevel = max(maxLevel, unit.level);
+    }
+    size_t cells = 1;
+    for (const SweepAxis& axis : axes) {
+        cells *= axis.count;
+        if (axis.kind == SweepAxisKind::Level) maxLevel = max(maxLevel, axis.value(axis.count - 1));
+    }
+    UnitProfileTable profiles(maxLevel);
+    const int armorCount = static_cast<int>(Armor::getArmorList().size());
+
+    results = ResultTable();
+    results.axes = axes;
+    for (size_t i = 0; i < axes.size(); ++i) results.dims[i] = axes[i].count;
+    results.resize(cells);
+    vector<unsigned char> stoppedEarly(cells, 0);
+
+    runWorkStealing(cells, settings.threads, [&](size_t cell, int) {
+        {
+            TraceScope span("sweep-cell");
+            vector<BuildUnit> groups[2] = { base[0], base[1] };
+            FocusStrategy strategy[2] = { baseStrategy[0], baseStrategy[1] };
+            size_t stride = cells;
+            for (const SweepAxis& axis : axes) {
+                stride /= axis.count;
+                int value = axis.value(static_cast<int>(cell / stride % axis.count));
+                vector<BuildUnit>& group = groups[axis.group - 1];
+                if (axis.kind == SweepAxisKind::Strategy) strategy[axis.group - 1] = static_cast<FocusStrategy>(value);
+                for (BuildUnit& unit : group) {
+                    if (axis.kind == SweepAxisKind::Level) unit.level = value;
+                    else if (axis.kind == SweepAxisKind::Equipment) {
+                        unit.weapon = value / armorCount;
+                        unit.armor = value % armorCount;
+                    }
+                }
+            }
+
+            CombatState state;
+            state.strategy[0] = strategy[0];
+            state.strategy[1] = strategy[1];
+            for (const BuildUnit& unit : groups[0]) state.addProfile(profiles.get(unit));
+            state.group1Size = state.unitCount;
+            for (const BuildUnit& unit : groups[1]) state.addProfile(profiles.get(unit));
+            state.buildHitTable();
+            state.initTargets();
+            if (settings.positional) state.deploy(settings.spacing, settings.gap);
+            state.spellPolicy = settings.spellPolicy;
+
+            RoundTally tally;
+            long long done = 0;
+            WinInterval interval = { 0.0, 0.0, 1.0 };
+            while (done < settings.rounds) {
+                long long batch = min(settings.batchRounds, settings.rounds - done);
+                RoundTally part;
+                runRoundBlock(state, done, batch, settings.seed, part);
+                tally.group1Wins += part.group1Wins;
+                tally.group2Wins += part.group2Wins;
+                done += batch;
+                interval = wilsonInterval(tally.group1Wins, done, settings.z);
+                bool decided = interval.upper < settings.decided || interval.lower > 1.0 - settings.decided;
+                bool precise = settings.precision > 0 && (interval.upper - interval.lower) / 2 <= settings.precision;
+                if (done < settings.rounds && (decided || precise)) {
+                    stoppedEarly[cell] = 1;
+                    break;
+                }
+            }
+            results.set(cell, state.fingerprint(), settings.seed, tally, interval);
+        }
+        profileFlush();
+    });
+
+    SweepSummary summary;
+    summary.cells = static_cast<long long>(cells);
+    for (size_t i = 0; i < cells; ++i) {
+        summary.decidedEarly += stoppedEarly[i];
+        summary.roundsSimulated += results.rounds[i];
+    }
+    return summary;
+}
+
+// The scenario's units as builds, so sweep cells can swap their parameters without touching Characters.
+vector<BuildUnit> buildUnitsOf(const vector<Character*>& group) {
+    vector<BuildUnit> units;
+    for (const Character* c : group) {
+        const Weapon* weapon = c->getWeapon();
+        const Armor* armor = c->getArmor();
+        units.push_back({ c->getCharacterClass(), c->getLevel(),
+                          weapon ? equipmentIndex(Weapon::getWeaponList(), weapon->getName(), weapon->getDamageBonus()) : -1,
+                          armor ? equipmentIndex(Armor::getArmorList(), armor->getName(), armor->getDefenseBonus()) : -1 });
+    }
+    return units;
+}
+
+void writeSweepResult(ostream& out, const Scenario& scenario, const SweepSettings& settings, const SweepSummary& summary,
+                      const string& resultsPath, double seconds) {
+    out << "{\"scenario\":\"" << jsonEscape(scenario.source) << "\",\"dims\":[";
+    for (size_t i = 0; i < scenario.sweep.size(); ++i) out << (i ? "," : "") << scenario.sweep[i].count;
+    out << "],\"cells\":" << summary.cells << ",\"roundsPerCell\":" << settings.rounds << ",\"seed\":" << settings.seed
+        << ",\"threads\":" << settings.threads << ",\"decidedEarly\":" << summary.decidedEarly
+        << ",\"roundsSimulated\":" << summary.roundsSimulated << ",\"results\":\"" << jsonEscape(resultsPath)
+        << "\",\"seconds\":" << seconds << "}\n";
+}
+
+// A run's whole random state is (seed, next round index), so a checkpoint is just that plus the totals so far.
+// It is written to <path>.tmp and renamed over the old one, so a crash mid-write keeps the previous checkpoint.
+struct Checkpoint {
+    static constexpr uint64_t Magic = 0x54504B433142414CULL; // "LAB1CKPT"
+    static constexpr uint32_t Version = 1;
+
+    uint64_t scenarioHash = 0;
+    uint64_t seed = 0;
+    long long totalRounds = 0;
+    long long nextRound = 0;
+    RoundTally tally;
+    bool hasStats = false;
+    BattleStats stats;
+};
+
+bool writeCheckpoint(const string& path, const Checkpoint& checkpoint, string& error) {
+    string temporary = path + ".tmp";
+    {
+        ofstream out(temporary, ios::binary | ios::trunc);
+        if (!out) {
+            error = "cannot write " + temporary;
+            return false;
+        }
+        writeBinary(out, Checkpoint::Magic);
+        writeBinary(out, Checkpoint::Version);
+        writeBinary(out, checkpoint.scenarioHash);
+        writeBinary(out, checkpoint.seed);
+        writeBinary(out, checkpoint.totalRounds);
+        writeBinary(out, checkpoint.nextRound);
+        writeBinary(out, checkpoint.tally.group1Wins);
+        writeBinary(out, checkpoint.tally.group2Wins);
+        writeBinary(out, static_cast<uint8_t>(checkpoint.hasStats));
+        if (checkpoint.hasStats) checkpoint.stats.save(out);
+        if (!out.flush()) {
+            error = "cannot write " + temporary;
+            return false;
+        }
+    }
+    if (rename(temporary.c_str(), path.c_str()) != 0) {
+        error = "cannot replace " + path;
+        return false;
+    }
+    return true;
+}
+
+bool readCheckpoint(const string& path, Checkpoint& checkpoint, string& error) {
+    ifstream in(path, ios::binary);
+    if (!in) {
+        error = "cannot open checkpoint " + path;
+        return false;
+    }
+    uint64_t magic = 0;
+    uint32_t version = 0;
+    uint8_t hasStats = 0;
+    if (!readBinary(in, magic) || magic != Checkpoint::Magic || !readBinary(in, version) || version != Checkpoint::Version) {
+        error = path + " is not a checkpoint written by this version";
+        return false;
+    }
+    bool ok = readBinary(in, checkpoint.scenarioHash) && readBinary(in, checkpoint.seed) &&
+              readBinary(in, checkpoint.totalRounds) && readBinary(in, checkpoint.nextRound) &&
+              readBinary(in, checkpoint.tally.group1Wins) && readBinary(in, checkpoint.tally.group2Wins) &&
+              readBinary(in, hasStats);
+    checkpoint.hasStats = hasStats != 0;
+    if (ok && checkpoint.hasStats) ok = checkpoint.stats.load(in);
+    if (!ok) {
+        error = "checkpoint " + path + " is truncated";
+        return false;
+    }
+    return true;
+}
+
+// Plays round roundIndex of a batch run on its own, logging every action. Roster scenarios must be
+// materialized first.
+int replayRound(Scenario& scenario, uint64_t seed, long long roundIndex) {
+    assignUnitIds(scenario.group1, scenario.group2);
+    CombatState state = CombatState::build(scenario.group1, scenario.group2, scenario.strategy[0], scenario.strategy[1]);
+    if (scenario.positional) state.deploy(scenario.spacing, scenario.gap);
+    state.spellPolicy = scenario.spellPolicy;
+    LogEventSink sink(scenario.group1, scenario.group2);
+    BattleRng rng(seed, static_cast<uint64_t>(roundIndex));
+
+    cout << "Replaying round " << roundIndex << " of " << scenario.source << " (seed " << seed << ")" << endl;
+    int winner = state.positional ? playPositionalRound(state, rng, &sink) : playRound(state, rng, &sink);
+    profileFlush();
+    cout << "Group " << winner << " wins round " << roundIndex << " after " << state.turns << " turn(s)." << endl;
+    return winner;
+}
+
+#if LAB1_HAS_SOCKETS
+// Coordinator/worker runs. Workers connect to the coordinator (unix:PATH or HOST:PORT) and are handed shards of
+// round ranges one at a time; a shard whose worker disconnects goes back on the queue. Rounds are keyed by
+// (seed, round index), so the merged result is the same as a local run. Every node must run the same build.
+enum class WireType : uint32_t { Job = 1, Result = 2, Quit = 3, Submit = 4, Cancel = 5, Answer = 6 };
+
+const uint32_t WireMaxPayload = 64u << 20;
+
+bool sendAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        data += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+bool receiveAll(int fd, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t received = recv(fd, data, size, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return false;
+        data += received;
+        size -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+bool sendMessage(int fd, WireType type, const string& payload) {
+    uint32_t header[2] = { static_cast<uint32_t>(type), static_cast<uint32_t>(payload.size()) };
+    return sendAll(fd, reinterpret_cast<const char*>(header), sizeof(header)) && sendAll(fd, payload.data(), payload.size());
+}
+
+bool receiveMessage(int fd, WireType& type, string& payload) {
+    uint32_t header[2];
+    if (!receiveAll(fd, reinterpret_cast<char*>(header), sizeof(header)) || header[1] > WireMaxPayload) return false;
+    type = static_cast<WireType>(header[0]);
+    payload.resize(header[1]);
+    return header[1] == 0 || receiveAll(fd, &payload[0], header[1]);
+}
+
+// The same framing for non-blocking peers, which buffer what they read and queue what they write.
+string frameMessage(WireType type, const string& payload) {
+    uint32_t header[2] = { static_cast<uint32_t>(type), static_cast<uint32_t>(payload.size()) };
+    return string(reinterpret_cast<const char*>(header), sizeof(header)) + payload;
+}
+
+// Decodes the frame starting at `offset` and moves past it. False while the frame is incomplete; `bad` is set
+// when its header announces more than WireMaxPayload.
+bool takeMessage(const string& buffer, size_t& offset, WireType& type, string& payload, bool& bad) {
+    uint32_t header[2];
+    bad = false;
+    if (buffer.size() - offset < sizeof(header)) return false;
+    memcpy(header, buffer.data() + offset, sizeof(header));
+    if (header[1] > WireMaxPayload) {
+        bad = true;
+        return false;
+    }
+    if (buffer.size() - offset - sizeof(header) < header[1]) return false;
+    type = static_cast<WireType>(header[0]);
+    payload.assign(buffer, offset + sizeof(header), header[1]);
+    offset += sizeof(header) + header[1];
+    return true;
+}
+
+// Appends whatever a non-blocking socket has ready to `inbox`. False once the peer hung up or the socket failed.
+bool receiveAvailable(int fd, string& inbox) {
+    char chunk[4096];
+    while (true) {
+        ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+        if (received > 0) {
+            inbox.append(chunk, static_cast<size_t>(received));
+            continue;
+        }
+        if (received < 0 && errno == EINTR) continue;
+        return received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+}
+
+// Sends as much of `outbox` as a non-blocking socket takes right now. False when the socket failed.
+bool sendAvailable(int fd, string& outbox) {
+    size_t done = 0;
+    while (done < outbox.size()) {
+        ssize_t sent = send(fd, outbox.data() + done, outbox.size() - done, MSG_NOSIGNAL);
+        if (sent > 0) {
+            done += static_cast<size_t>(sent);
+            continue;
+        }
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        return false;
+    }
+    outbox.erase(0, done);
+    return true;
+}
+
+struct ShardJob {
+    uint64_t shardId = 0;
+    uint64_t seed = 0;
+    long long firstRound = 0;
+    long long rounds = 0;
+    bool withStats = false;
+    string scenarioText;
+
+    string encode() const {
+        ostringstream out;
+        writeBinary(out, shardId);
+        writeBinary(out, seed);
+        writeBinary(out, firstRound);
+        writeBinary(out, rounds);
+        writeBinary(out, static_cast<uint8_t>(withStats));
+        out << scenarioText;
+        return out.str();
+    }
+
+    bool decode(const string& payload) {
+        istringstream in(payload);
+        uint8_t stats = 0;
+        if (!readBinary(in, shardId) || !readBinary(in, seed) || !readBinary(in, firstRound) ||
+            !readBinary(in, rounds) || !readBinary(in, stats)) {
+            return false;
+        }
+        withStats = stats != 0;
+        scenarioText.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        return true;
+    }
+};
+
+struct ShardResult {
+    uint64_t shardId = 0;
+    uint64_t scenarioHash = 0;
+    RoundTally tally;
+    bool hasStats = false;
+    BattleStats stats;
+
+    string encode() const {
+        ostringstream out;
+        writeBinary(out, shardId);
+        writeBinary(out, scenarioHash);
+        writeBinary(out, tally.group1Wins);
+        writeBinary(out, tally.group2Wins);
+        writeBinary(out, static_cast<uint8_t>(hasStats));
+        if (hasStats) stats.save(out);
+        return out.str();
+    }
+
+    bool decode(const string& payload) {
+        istringstream in(payload);
+        uint8_t withStats = 0;
+        if (!readBinary(in, shardId) || !readBinary(in, scenarioHash) || !readBinary(in, tally.group1Wins) ||
+            !readBinary(in, tally.group2Wins) || !readBinary(in, withStats)) {
+            return false;
+        }
+        hasStats = withStats != 0;
+        return !hasStats || stats.load(in);
+    }
+};
+
+// "unix:/path" or "host:port"; an empty host listens on every interface.
+int openSocket(const string& address, bool listening, string& error) {
+    if (address.compare(0, 5, "unix:") == 0) {
+        string path = address.substr(5);
+        sockaddr_un local = {};
+        if (path.empty() || path.size() >= sizeof(local.sun_path)) {
+            error = "bad unix socket path '" + path + "'";
+            return -1;
+        }
+        local.sun_family = AF_UNIX;
+        copy(path.begin(), path.end(), local.sun_path);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            error = "cannot create socket";
+            return -1;
+        }
+        if (listening) unlink(path.c_str());
+        int result = listening ? ::bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local))
+                               : connect(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local));
+        if (result != 0 || (listening && listen(fd, 64) != 0)) {
+            error = string(listening ? "cannot listen on " : "cannot connect to ") + address;
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    size_t colon = address.rfind(':');
+    if (colon == string::npos) {
+        error = "address must be unix:PATH or HOST:PORT";
+        return -1;
+    }
+    string host = address.substr(0, colon);
+    string port = address.substr(colon + 1);
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    addrinfo* found = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found) != 0) {
+        error = "cannot resolve " + address;
+        return -1;
+    }
+    int fd = -1;
+    for (addrinfo* candidate = found; candidate && fd < 0; candidate = candidate->ai_next) {
+        fd = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (fd < 0) continue;
+        int yes = 1;
+        if (listening) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        int result = listening ? ::bind(fd, candidate->ai_addr, candidate->ai_addrlen) : connect(fd, candidate->ai_addr, candidate->ai_addrlen);
+        if (result != 0 || (listening && listen(fd, 64) != 0)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    if (fd < 0) error = string(listening ? "cannot listen on " : "cannot connect to ") + address;
+    return fd;
+}
+
+// Serves shards until the coordinator says quit or goes away. The last scenario is kept parsed between shards.
+int runWorker(const string& address, int threads) {
+    string error;
+    int fd = -1;
+    for (int attempt = 0; attempt < 150 && fd < 0; ++attempt) {
+        fd = openSocket(address, false, error);
+        if (fd < 0) this_thread::sleep_for(chrono::milliseconds(200));
+    }
+    if (fd < 0) {
+        cerr << "worker: " << error << "\n";
+        return 1;
+    }
+
+    unique_ptr<Scenario> scenario;
+    CombatState initial;
+    WireType type;
+    string payload;
+    while (receiveMessage(fd, type, payload) && type == WireType::Job) {
+        ShardJob job;
+        if (!job.decode(payload)) break;
+        if (!scenario || scenario->text != job.scenarioText) {
+            scenario.reset(new Scenario());
+            scenario->text = job.scenarioText;
+            istringstream in(job.scenarioText);
+            if (!parseScenario(in, *scenario, error) || scenarioGroupSize(*scenario, 0) == 0 || scenarioGroupSize(*scenario, 1) == 0) {
+                cerr << "worker: bad scenario: " << error << "\n";
+                break;
+            }
+            if (!scenarioState(*scenario, initial)) {
+                cerr << "worker: bad scenario: " << BadRosterError << "\n";
+                break;
+            }
+        }
+
+        ShardResult result;
+        result.shardId = job.shardId;
+        result.scenarioHash = initial.fingerprint();
+        result.hasStats = job.withStats;
+        result.stats.reset(initial.unitCount);
+        result.tally = runRoundsParallel(initial, job.rounds, job.seed, threads, job.firstRound, job.withStats ? &result.stats : nullptr);
+        if (!sendMessage(fd, WireType::Result, result.encode())) break;
+    }
+    close(fd);
+    return 0;
+}
+
+struct DistributedRun {
+    Scenario* scenario = nullptr;
+    CombatState initial;
+    uint64_t seed = 0;
+    RoundTally tally;
+    BattleStats stats;
+};
+
+struct DistributedSettings {
+    string address;
+    long long shardRounds = 1000000;
+    int localWorkers = 0;
+    int workerThreads = 1;
+    bool withStats = false;
+    double shardTimeout = 600.0;
+    double workerTimeout = 60.0;
+};
+
+// Hands out every run's rounds in shards and merges the results into runs[i].tally / stats.
+bool coordinateRuns(vector<DistributedRun>& runs, const DistributedSettings& settings, int& workersSeen) {
+    struct Shard {
+        size_t run;
+        long long firstRound;
+        long long rounds;
+    };
+    vector<Shard> shards;
+    for (size_t r = 0; r < runs.size(); ++r) {
+        long long total = runs[r].scenario->rounds;
+        for (long long first = 0; first < total; first += settings.shardRounds) {
+            shards.push_back({ r, first, min(settings.shardRounds, total - first) });
+        }
+    }
+
+    string error;
+    int listener = openSocket(settings.address, true, error);
+    if (listener < 0) {
+        cerr << "coordinator: " << error << "\n";
+        return false;
+    }
+
+    // Worker connections are non-blocking like the service's: a worker that stalls mid-frame only runs into
+    // its shard deadline instead of holding up the others.
+    struct Worker {
+        int fd;
+        string inbox;
+        string outbox;
+        long long assigned;
+        chrono::steady_clock::time_point dispatched;
+    };
+    vector<Worker> workers;
+    vector<pid_t> children;
+    int restartsLeft = 3 * settings.localWorkers;
+    auto spawnWorker = [&]() {
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(listener);
+            for (const Worker& worker : workers) close(worker.fd);
+            _exit(runWorker(settings.address, settings.workerThreads));
+        }
+        if (pid > 0) children.push_back(pid);
+    };
+    for (int i = 0; i < settings.localWorkers; ++i) spawnWorker();
+
+    deque<size_t> pending;
+    for (size_t i = 0; i < shards.size(); ++i) pending.push_back(i);
+    size_t completed = 0;
+    bool ok = true;
+
+    auto dropWorker = [&](size_t w) {
+        if (workers[w].assigned >= 0) pending.push_front(static_cast<size_t>(workers[w].assigned));
+        close(workers[w].fd);
+        workers.erase(workers.begin() + w);
+    };
+    // False when the worker has to go: a malformed frame, an answer for another shard, or another matchup.
+    auto takeResult = [&](Worker& worker, WireType type, const string& payload) {
+        ShardResult result;
+        if (type != WireType::Result || !result.decode(payload) || static_cast<long long>(result.shardId) != worker.assigned) {
+            return false;
+        }
+        DistributedRun& run = runs[shards[result.shardId].run];
+        if (result.scenarioHash != run.initial.fingerprint()) {
+            cerr << "coordinator: dropping a worker that built a different matchup; is it running the same version?\n";
+            return false;
+        }
+        run.tally.group1Wins += result.tally.group1Wins;
+        run.tally.group2Wins += result.tally.group2Wins;
+        if (result.hasStats) run.stats.merge(result.stats);
+        worker.assigned = -1;
+        completed++;
+        return true;
+    };
+
+    workersSeen = 0;
+    auto lastConnected = chrono::steady_clock::now();
+    while (completed < shards.size() && ok) {
+        for (Worker& worker : workers) {
+            if (worker.assigned >= 0 || pending.empty()) continue;
+            size_t index = pending.front();
+            pending.pop_front();
+            const DistributedRun& run = runs[shards[index].run];
+            ShardJob job;
+            job.shardId = index;
+            job.seed = run.seed;
+            job.firstRound = shards[index].firstRound;
+            job.rounds = shards[index].rounds;
+            job.withStats = settings.withStats;
+            job.scenarioText = run.scenario->text;
+            worker.assigned = static_cast<long long>(index);
+            worker.dispatched = chrono::steady_clock::now();
+            worker.outbox += frameMessage(WireType::Job, job.encode());
+        }
+        for (size_t w = workers.size(); w-- > 0;) {
+            if (!sendAvailable(workers[w].fd, workers[w].outbox)) dropWorker(w);
+        }
+
+        vector<pollfd> polled(1, pollfd{ listener, POLLIN, 0 });
+        for (const Worker& worker : workers) {
+            polled.push_back(pollfd{ worker.fd, static_cast<short>(POLLIN | (worker.outbox.empty() ? 0 : POLLOUT)), 0 });
+        }
+        if (poll(polled.data(), polled.size(), 500) < 0 && errno != EINTR) {
+            ok = false;
+            break;
+        }
+
+        // Backwards, so dropping a worker does not shift the ones still to be checked.
+        for (size_t w = polled.size() - 1; w >= 1; --w) {
+            Worker& worker = workers[w - 1];
+            if ((polled[w].revents & POLLOUT) && !sendAvailable(worker.fd, worker.outbox)) {
+                dropWorker(w - 1);
+                continue;
+            }
+            if (!(polled[w].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            bool keep = receiveAvailable(worker.fd, worker.inbox);
+            size_t offset = 0;
+            WireType type;
+            string payload;
+            bool bad = false;
+            while (keep && takeMessage(worker.inbox, offset, type, payload, bad)) keep = takeResult(worker, type, payload);
+            if (!keep || bad) {
+                dropWorker(w - 1);
+                continue;
+            }
+            worker.inbox.erase(0, offset);
+        }
+
+        if (polled[0].revents & POLLIN) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd >= 0) {
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                workers.push_back(Worker{ fd, string(), string(), -1, chrono::steady_clock::now() });
+                workersSeen++;
+            }
+        }
+
+        // A worker that is alive but silent would hold its shard forever; past the deadline it is dropped and
+        // the shard goes back on the queue.
+        auto now = chrono::steady_clock::now();
+        for (size_t w = workers.size(); w-- > 0;) {
+            if (workers[w].assigned >= 0 && chrono::duration<double>(now - workers[w].dispatched).count() > settings.shardTimeout) {
+                cerr << "coordinator: a worker missed the shard deadline; handing its shard to another\n";
+                dropWorker(w);
+            }
+        }
+
+        for (size_t c = 0; c < children.size(); ++c) {
+            if (waitpid(children[c], nullptr, WNOHANG) != children[c]) continue;
+            children.erase(children.begin() + c--);
+            if (completed < shards.size() && restartsLeft-- > 0) spawnWorker();
+        }
+        if (settings.localWorkers > 0 && children.empty() && workers.empty()) {
+            cerr << "coordinator: every local worker died\n";
+            ok = false;
+        }
+        if (!workers.empty()) {
+            lastConnected = now;
+        } else if (ok && chrono::duration<double>(now - lastConnected).count() > settings.workerTimeout) {
+            cerr << "coordinator: no worker has been connected for " << settings.workerTimeout << " seconds\n";
+            ok = false;
+        }
+    }
+
+    for (Worker& worker : workers) {
+        worker.outbox += frameMessage(WireType::Quit, string());
+        sendAvailable(worker.fd, worker.outbox);
+        close(worker.fd);
+    }
+    close(listener);
+    if (settings.address.compare(0, 5, "unix:") == 0) unlink(settings.address.substr(5).c_str());
+    // Healthy workers exit on Quit; a hung one would keep waitpid() from returning.
+    for (pid_t child : children) {
+        kill(child, SIGTERM);
+        waitpid(child, nullptr, 0);
+    }
+    return ok;
+}
+
+int runCoordinatorCli(const vector<string>& paths, OutputFormat format, bool withStats, const string& address,
+                      int localWorkers, long long shardRounds, double shardTimeout, double workerTimeout, int threadOverride,
+                      const string& resultsPath) {
+    vector<unique_ptr<Scenario>> scenarios;
+    vector<DistributedRun> runs;
+    int failures = 0;
+    for (const string& path : paths) {
+        unique_ptr<Scenario> scenario(new Scenario());
+        string error;
+        if (!loadScenario(path, *scenario, error)) {
+            cerr << path << ": " << error << "\n";
+            failures++;
+            continue;
+        }
+        if (scenarioGroupSize(*scenario, 0) == 0 || scenarioGroupSize(*scenario, 1) == 0 || scenario->precision > 0) {
+            cerr << path << ": needs units in both groups and a fixed round count\n";
+            failures++;
+            continue;
+        }
+        DistributedRun run;
+        run.scenario = scenario.get();
+        if (!scenarioState(*scenario, run.initial)) {
+            cerr << path << ": " << BadRosterError << "\n";
+            failures++;
+            continue;
+        }
+        run.seed = scenario->hasSeed ? scenario->seed : randomSeed();
+        run.stats.reset(run.initial.unitCount);
+        runs.push_back(move(run));
+        scenarios.push_back(move(scenario));
+    }
+    if (runs.empty()) return 1;
+
+    DistributedSettings settings;
+    settings.address = address;
+    settings.shardRounds = shardRounds;
+    settings.shardTimeout = shardTimeout;
+    settings.workerTimeout = workerTimeout;
+    settings.localWorkers = localWorkers;
+    settings.withStats = withStats;
+    settings.workerThreads = threadOverride > 0 ? threadOverride : max(1, defaultThreadCount() / max(1, localWorkers));
+
+    auto start = chrono::steady_clock::now();
+    int workersSeen = 0;
+    if (!coordinateRuns(runs, settings, workersSeen)) return 1;
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if (format == OutputFormat::Csv) {
+        cout << "scenario,group1Size,group2Size,rounds,seed,threads,group1Wins,group2Wins,"
+                "group1WinProbability,group2WinProbability,confidence,group1WinLower,group1WinUpper,seconds";
+        if (withStats) cout << ",turnsMean,turnsP50,turnsP90,turnsP99,group1SurvivorsMean,group2SurvivorsMean";
+        cout << "\n";
+    }
+    ResultTable results;
+    for (const DistributedRun& run : runs) {
+        writeBatchResult(cout, format, *run.scenario, run.seed, workersSeen, run.tally, seconds, withStats ? &run.stats : nullptr);
+        results.add(run.initial.fingerprint(), run.seed, run.tally,
+                    wilsonInterval(run.tally.group1Wins, run.tally.group1Wins + run.tally.group2Wins,
+                                   confidenceToZ(run.scenario->confidence)));
+    }
+    cout.flush();
+    string error;
+    if (!resultsPath.empty() && !results.save(resultsPath, error)) {
+        cerr << error << "\n";
+        failures++;
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+// Simulation service. Clients submit scenarios over a socket and one shared pool plays every job in slices of
+// rounds, highest priority first, so a cancel or a more urgent job takes effect at the next slice. Finished results
+// are cached under the matchup's fingerprint plus the run settings; an identical job already running is joined.
+enum class ServiceStatus : uint8_t { Done = 0, Cancelled = 1, Failed = 2 };
+
+const long long ServiceSliceRounds = 1 << 15;
+
+struct ServiceRequest {
+    uint64_t jobId = 0;
+    int32_t priority = 0;
+    double precision = 0.0;
+    double confidence = 0.0;
+    string scenarioText;
+
+    string encode() const {
+        ostringstream out;
+        writeBinary(out, jobId);
+        writeBinary(out, priority);
+        writeBinary(out, precision);
+        writeBinary(out, confidence);
+        out << scenarioText;
+        return out.str();
+    }
+
+    bool decode(const string& payload) {
+        istringstream in(payload);
+        if (!readBinary(in, jobId) || !readBinary(in, priority) || !readBinary(in, precision) || !readBinary(in, confidence)) {
+            return false;
+        }
+        scenarioText.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        return true;
+    }
+};
 
-    cout << "Welcome to the Battle Simulation!\n";
-    cout << "You can create characters for 2 groups and simulate battles between them!\n";
-    
-    do {
-        cout << "\nMain Menu:\n";
-        cout << "1. Create character for Group 1\n";
-        cout << "2. Create character for Group 2\n";
-        cout << "3. Display all characters\n";
-        cout << "4. Set up and run battle simulation\n";
-        cout << "5. Choose strategy\n";
-        cout << "6. Exit\n";
-        choice = getValidatedInput("Enter your choice: ", 1, 6);
+struct ServiceAnswer {
+    uint64_t jobId = 0;
+    ServiceStatus status = ServiceStatus::Done;
+    bool cached = false;
+    uint64_t seed = 0;
+    int32_t threads = 0;
+    RoundTally tally;
+    string error;
 
-        switch (choice) {
-            case 1: {
-                cout << "\nCreating character for Group 1...\n";
-                Character* newCharacter = createCharacter();
-                if (newCharacter) {
-                    group1.push_back(newCharacter);
-                }
-                break;
+    string encode() const {
+        ostringstream out;
+        writeBinary(out, jobId);
+        writeBinary(out, static_cast<uint8_t>(status));
+        writeBinary(out, static_cast<uint8_t>(cached));
+        writeBinary(out, seed);
+        writeBinary(out, threads);
+        writeBinary(out, tally.group1Wins);
+        writeBinary(out, tally.group2Wins);
+        out << error;
+        return out.str();
+    }
+
+    bool decode(const string& payload) {
+        istringstream in(payload);
+        uint8_t state = 0, fromCache = 0;
+        if (!readBinary(in, jobId) || !readBinary(in, state) || !readBinary(in, fromCache) || !readBinary(in, seed) ||
+            !readBinary(in, threads) || !readBinary(in, tally.group1Wins) || !readBinary(in, tally.group2Wins)) {
+            return false;
+        }
+        status = static_cast<ServiceStatus>(state);
+        cached = fromCache != 0;
+        error.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        return true;
+    }
+};
+
+// The fingerprint covers rosters, equipment and strategies; the rest is what else changes the answer. Without a
+// fixed seed any seed will do, so unseeded requests for the same matchup share one entry.
+uint64_t serviceKey(const CombatState& initial, const Scenario& scenario) {
+    uint64_t hash = initial.fingerprint();
+    auto mix = [&hash](uint64_t value) {
+        for (int i = 0; i < 8; ++i) {
+            hash ^= (value >> (8 * i)) & 0xFF;
+            hash *= 0x100000001B3ULL;
+        }
+    };
+    auto bits = [](double value) {
+        uint64_t word;
+        memcpy(&word, &value, sizeof(word));
+        return word;
+    };
+    mix(static_cast<uint64_t>(scenario.rounds));
+    mix(bits(scenario.precision));
+    if (scenario.precision > 0) mix(bits(scenario.confidence));
+    mix(scenario.hasSeed);
+    if (scenario.hasSeed) mix(scenario.seed);
+    return hash;
+}
+
+// Least recently used entries go first.
+class ResultCache {
+public:
+    explicit ResultCache(size_t capacity) : capacity(max<size_t>(1, capacity)) {}
+
+    bool find(uint64_t key, ServiceAnswer& answer) {
+        auto found = index.find(key);
+        if (found == index.end()) return false;
+        entries.splice(entries.begin(), entries, found->second);
+        answer = found->second->second;
+        return true;
+    }
+
+    void store(uint64_t key, const ServiceAnswer& answer) {
+        auto found = index.find(key);
+        if (found != index.end()) entries.erase(found->second);
+        entries.emplace_front(key, answer);
+        index[key] = entries.begin();
+        if (entries.size() > capacity) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+private:
+    size_t capacity;
+    list<pair<uint64_t, ServiceAnswer>> entries;
+    unordered_map<uint64_t, list<pair<uint64_t, ServiceAnswer>>::iterator> index;
+};
+
+struct ServiceWaiter {
+    uint64_t client;
+    uint64_t jobId;
+};
+
+struct ServiceJob {
+    uint64_t key = 0;
+    uint64_t order = 0;
+    int priority = 0;
+    CombatState initial;
+    uint64_t seed = 0;
+    long long maxRounds = 0;
+    double halfWidth = 0.0;
+    double z = 0.0;
+    long long minBatch = 0;
+    long long batchEnd = 0;
+    long long claimed = 0;
+    int inFlight = 0;
+    RoundTally tally;
+    bool cancelled = false;
+    vector<ServiceWaiter> waiters;
+
+    // Rounds are released in runUntilPrecise's batches and the next batch is only sized once the previous one is
+    // fully merged, so a seeded job counts the same rounds as a local run with as many threads as the pool.
+    bool claimable() const { return !cancelled && claimed < batchEnd; }
+
+    // Called when nothing is in flight and the batch is played out; false when the job is finished.
+    bool releaseBatch() {
+        long long batch = nextPreciseBatch(tally, claimed, halfWidth, z, maxRounds, minBatch);
+        batchEnd += batch;
+        return batch > 0;
+    }
+};
+
+// A request that no pool thread has parsed yet.
+struct ServiceSubmission {
+    ServiceWaiter waiter;
+    ServiceRequest request;
+    bool started = false;
+    bool cancelled = false;
+};
+
+// Jobs and answers are guarded by one mutex; the pool threads only touch sockets through the wake pipe, whose
+// read end the serving loop polls next to the clients. Parsing and building the initial state run on the pool
+// too, ahead of simulation slices, so the serving loop never does more than copy bytes.
+class SimulationService {
+public:
+    typedef pair<uint64_t, ServiceAnswer> Reply;
+
+    SimulationService(int threads, size_t cacheSize, int wakeFd) : cache(cacheSize), wakeFd(wakeFd), threads(max(1, threads)) {
+        for (int t = 0; t < this->threads; ++t) pool.emplace_back(&SimulationService::work, this);
+    }
+
+    ~SimulationService() {
+        {
+            lock_guard<mutex> lock(guard);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (thread& worker : pool) worker.join();
+    }
+
+    // The answer, even a cache hit, arrives through takeFinished().
+    void submit(uint64_t client, const ServiceRequest& request) {
+        shared_ptr<ServiceSubmission> submission(new ServiceSubmission());
+        submission->waiter = { client, request.jobId };
+        submission->request = request;
+        lock_guard<mutex> lock(guard);
+        submissions.push_back(submission);
+        ready.notify_one();
+    }
+
+    void cancel(uint64_t client, uint64_t jobId, vector<Reply>& replies) {
+        lock_guard<mutex> lock(guard);
+        for (size_t s = 0; s < submissions.size(); ++s) {
+            ServiceSubmission& submission = *submissions[s];
+            if (submission.cancelled || submission.waiter.client != client || submission.waiter.jobId != jobId) continue;
+            submission.cancelled = true;
+            if (!submission.started) submissions.erase(submissions.begin() + s);
+            replies.push_back({ client, cancelledAnswer(jobId) });
+            return;
+        }
+        for (size_t j = 0; j < jobs.size(); ++j) {
+            vector<ServiceWaiter>& waiters = jobs[j]->waiters;
+            for (size_t w = 0; w < waiters.size(); ++w) {
+                if (waiters[w].client != client || waiters[w].jobId != jobId) continue;
+                waiters.erase(waiters.begin() + w);
+                replies.push_back({ client, cancelledAnswer(jobId) });
+                if (waiters.empty()) abandon(j);
+                return;
             }
-            case 2: {
-                cout << "\nCreating character for Group 2...\n";
-                Character* newCharacter = createCharacter();
-                if (newCharacter) {
-                    group2.push_back(newCharacter);
-                }
-                break;
+        }
+    }
+
+    void dropClient(uint64_t client) {
+        lock_guard<mutex> lock(guard);
+        for (size_t s = submissions.size(); s-- > 0;) {
+            if (submissions[s]->waiter.client != client) continue;
+            submissions[s]->cancelled = true;
+            if (!submissions[s]->started) submissions.erase(submissions.begin() + s);
+        }
+        for (size_t j = jobs.size(); j-- > 0;) {
+            vector<ServiceWaiter>& waiters = jobs[j]->waiters;
+            bool had = !waiters.empty();
+            waiters.erase(remove_if(waiters.begin(), waiters.end(), [client](const ServiceWaiter& w) { return w.client == client; }),
+                          waiters.end());
+            if (had && waiters.empty()) abandon(j);
+        }
+    }
+
+    void takeFinished(vector<Reply>& replies) {
+        lock_guard<mutex> lock(guard);
+        replies.insert(replies.end(), finished.begin(), finished.end());
+        finished.clear();
+    }
+
+private:
+    ServiceAnswer cancelledAnswer(uint64_t jobId) const {
+        ServiceAnswer answer;
+        answer.jobId = jobId;
+        answer.status = ServiceStatus::Cancelled;
+        answer.threads = threads;
+        return answer;
+    }
+
+    void wakeLoop() {
+        char signal = 1;
+        if (write(wakeFd, &signal, 1) < 0) {
+            // A full pipe already has the serving loop awake.
+        }
+    }
+
+    shared_ptr<ServiceSubmission> nextSubmission() const {
+        for (const shared_ptr<ServiceSubmission>& submission : submissions) {
+            if (!submission->started) return submission;
+        }
+        return nullptr;
+    }
+
+    // Called with the lock held; parses without it. A failed or cached request is answered, anything else
+    // joins an identical running job or queues a new one.
+    void accept(unique_lock<mutex>& lock, const shared_ptr<ServiceSubmission>& submission) {
+        submission->started = true;
+        lock.unlock();
+        const ServiceRequest& request = submission->request;
+        ServiceAnswer answer;
+        answer.jobId = request.jobId;
+        answer.threads = threads;
+        Scenario scenario;
+        scenario.text = request.scenarioText;
+        istringstream in(scenario.text);
+        shared_ptr<ServiceJob> job(new ServiceJob());
+        if (!parseScenario(in, scenario, answer.error) || scenarioGroupSize(scenario, 0) == 0 || scenarioGroupSize(scenario, 1) == 0) {
+            if (answer.error.empty()) answer.error = "both groups must have at least one unit";
+            answer.status = ServiceStatus::Failed;
+        } else {
+            if (request.precision > 0) scenario.precision = request.precision;
+            if (request.confidence > 0) scenario.confidence = request.confidence;
+            if (scenario.precision > 0 && !scenario.hasRounds) scenario.rounds = 1000000000LL;
+            if (!scenarioState(scenario, job->initial)) {
+                answer.error = BadRosterError;
+                answer.status = ServiceStatus::Failed;
             }
-            case 3: {
-                cout << "\nDisplaying all characters:\n";
-                cout << "\n--- Group 1 ---\n";
-                for (const Character* character : group1) {
-                    character->display();
-                    cout << endl;
+        }
+        if (answer.status != ServiceStatus::Failed) {
+            job->key = serviceKey(job->initial, scenario);
+            job->priority = request.priority;
+            job->seed = scenario.hasSeed ? scenario.seed : randomSeed();
+            job->maxRounds = scenario.rounds;
+            job->halfWidth = scenario.precision;
+            job->z = confidenceToZ(scenario.confidence);
+            job->minBatch = preciseMinBatch(threads);
+            job->releaseBatch();
+            job->waiters.push_back(submission->waiter);
+        }
+        lock.lock();
+
+        submissions.erase(find(submissions.begin(), submissions.end(), submission));
+        if (submission->cancelled) return;
+        if (answer.status == ServiceStatus::Failed || cache.find(job->key, answer)) {
+            answer.jobId = request.jobId;
+            answer.cached = answer.status != ServiceStatus::Failed;
+            finished.push_back({ submission->waiter.client, answer });
+            wakeLoop();
+            return;
+        }
+        for (const shared_ptr<ServiceJob>& running : jobs) {
+            if (running->key != job->key || running->cancelled) continue;
+            running->waiters.push_back(submission->waiter);
+            running->priority = max(running->priority, request.priority);
+            return;
+        }
+        job->order = nextOrder++;
+        jobs.push_back(job);
+        ready.notify_all();
+    }
+
+    // Nobody wants the job any more; slices already running finish and are thrown away.
+    void abandon(size_t j) {
+        jobs[j]->cancelled = true;
+        if (jobs[j]->inFlight == 0) jobs.erase(jobs.begin() + j);
+    }
+
+    shared_ptr<ServiceJob> nextJob() const {
+        shared_ptr<ServiceJob> best;
+        for (const shared_ptr<ServiceJob>& job : jobs) {
+            if (!job->claimable()) continue;
+            if (!best || job->priority > best->priority || (job->priority == best->priority && job->order < best->order)) best = job;
+        }
+        return best;
+    }
+
+    void complete(const shared_ptr<ServiceJob>& job) {
+        jobs.erase(find(jobs.begin(), jobs.end(), job));
+        if (job->cancelled) return;
+        ServiceAnswer answer;
+        answer.seed = job->seed;
+        answer.threads = threads;
+        answer.tally = job->tally;
+        cache.store(job->key, answer);
+        for (const ServiceWaiter& waiter : job->waiters) {
+            answer.jobId = waiter.jobId;
+            finished.push_back({ waiter.client, answer });
+        }
+        wakeLoop();
+    }
+
+    void work() {
+        unique_lock<mutex> lock(guard);
+        while (true) {
+            shared_ptr<ServiceSubmission> submission;
+            shared_ptr<ServiceJob> job;
+            ready.wait(lock, [&]() { return stopping || (submission = nextSubmission()) || (job = nextJob()); });
+            if (stopping) return;
+            if (submission) {
+                accept(lock, submission);
+                continue;
+            }
+
+            long long firstRound = job->claimed;
+            long long rounds = min(ServiceSliceRounds, job->batchEnd - firstRound);
+            job->claimed += rounds;
+            job->inFlight++;
+            lock.unlock();
+            RoundTally part;
+            runRoundBlock(job->initial, firstRound, rounds, job->seed, part);
+            lock.lock();
+            job->tally.group1Wins += part.group1Wins;
+            job->tally.group2Wins += part.group2Wins;
+            job->inFlight--;
+            if (job->inFlight > 0 || (!job->cancelled && job->claimed < job->batchEnd)) continue;
+            if (!job->cancelled && job->releaseBatch()) {
+                ready.notify_all();
+            } else {
+                complete(job);
+            }
+        }
+    }
+
+    mutex guard;
+    condition_variable ready;
+    vector<shared_ptr<ServiceSubmission>> submissions;
+    vector<shared_ptr<ServiceJob>> jobs;
+    vector<Reply> finished;
+    ResultCache cache;
+    uint64_t nextOrder = 0;
+    bool stopping = false;
+    int wakeFd;
+    int threads;
+    vector<thread> pool;
+};
+
+// Service connections are non-blocking: requests are decoded once a whole frame has arrived and answers wait
+// in an outbox, so a client that stalls mid-frame or stops reading holds up nobody else.
+struct ServiceClient {
+    int fd;
+    string inbox;
+    string outbox;
+};
+
+int runService(const string& address, int threads, size_t cacheSize) {
+    string error;
+    int listener = openSocket(address, true, error);
+    int wake[2];
+    if (listener < 0 || pipe(wake) != 0) {
+        cerr << "service: " << (listener < 0 ? error : string("cannot create a pipe")) << "\n";
+        if (listener >= 0) close(listener);
+        return 1;
+    }
+    fcntl(wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake[1], F_SETFL, O_NONBLOCK);
+    cerr << "service: listening on " << address << " with " << threads << " thread(s)\n";
+
+    SimulationService service(threads, cacheSize, wake[1]);
+    map<uint64_t, ServiceClient> clients;
+    uint64_t nextClient = 0;
+    vector<SimulationService::Reply> replies;
+    auto dropClient = [&](uint64_t client) {
+        service.dropClient(client);
+        close(clients[client].fd);
+        clients.erase(client);
+    };
+    // False when the client has to go: it hung up, broke the protocol, or let its outbox grow past a frame.
+    auto readClient = [&](uint64_t client) {
+        ServiceClient& connection = clients[client];
+        if (!receiveAvailable(connection.fd, connection.inbox)) return false;
+        size_t offset = 0;
+        WireType type;
+        string payload;
+        bool bad = false;
+        while (takeMessage(connection.inbox, offset, type, payload, bad)) {
+            ServiceRequest request;
+            uint64_t jobId = 0;
+            if (type == WireType::Submit && request.decode(payload)) {
+                service.submit(client, request);
+            } else if (type == WireType::Cancel && payload.size() == sizeof(jobId)) {
+                memcpy(&jobId, payload.data(), sizeof(jobId));
+                service.cancel(client, jobId, replies);
+            } else {
+                return false;
+            }
+        }
+        connection.inbox.erase(0, offset);
+        return !bad;
+    };
+    auto flushClient = [&](uint64_t client) {
+        ServiceClient& connection = clients[client];
+        return sendAvailable(connection.fd, connection.outbox) && connection.outbox.size() <= WireMaxPayload;
+    };
+
+    while (true) {
+        vector<pollfd> polled = { pollfd{ listener, POLLIN, 0 }, pollfd{ wake[0], POLLIN, 0 } };
+        vector<uint64_t> polledClients;
+        for (const auto& client : clients) {
+            short events = static_cast<short>(POLLIN | (client.second.outbox.empty() ? 0 : POLLOUT));
+            polled.push_back(pollfd{ client.second.fd, events, 0 });
+            polledClients.push_back(client.first);
+        }
+        if (poll(polled.data(), polled.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (size_t c = 0; c < polledClients.size(); ++c) {
+            uint64_t client = polledClients[c];
+            short events = polled[c + 2].revents;
+            if ((events & POLLOUT) && !flushClient(client)) {
+                dropClient(client);
+            } else if ((events & (POLLIN | POLLHUP | POLLERR)) && !readClient(client)) {
+                dropClient(client);
+            }
+        }
+
+        if (polled[1].revents & POLLIN) {
+            char drained[64];
+            while (read(wake[0], drained, sizeof(drained)) > 0) {
+            }
+        }
+        service.takeFinished(replies);
+        for (const SimulationService::Reply& reply : replies) {
+            auto client = clients.find(reply.first);
+            if (client == clients.end()) continue;
+            client->second.outbox += frameMessage(WireType::Answer, reply.second.encode());
+            if (!flushClient(reply.first)) dropClient(reply.first);
+        }
+        replies.clear();
+
+        if (polled[0].revents & POLLIN) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd >= 0) {
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                clients[nextClient++] = ServiceClient{ fd, string(), string() };
+            }
+        }
+    }
+
+    for (const auto& client : clients) close(client.second.fd);
+    close(listener);
+    close(wake[0]);
+    close(wake[1]);
+    if (address.compare(0, 5, "unix:") == 0) unlink(address.substr(5).c_str());
+    return 1;
+}
+
+// Sends every scenario to the service and prints the answers in order. Jobs still running after `timeout`
+// seconds are cancelled; "seconds" in the output is the time until the answer arrived.
+int runSubmitCli(const vector<string>& paths, OutputFormat format, const string& address, int priority,
+                 double precisionOverride, double confidenceOverride, double timeout) {
+    vector<unique_ptr<Scenario>> scenarios;
+    int failures = 0;
+    for (const string& path : paths) {
+        unique_ptr<Scenario> scenario(new Scenario());
+        string error;
+        if (!loadScenario(path, *scenario, error)) {
+            cerr << path << ": " << error << "\n";
+            failures++;
+            continue;
+        }
+        if (confidenceOverride > 0) scenario->confidence = confidenceOverride;
+        scenarios.push_back(move(scenario));
+    }
+    if (scenarios.empty()) return 1;
+
+    string error;
+    int fd = openSocket(address, false, error);
+    if (fd < 0) {
+        cerr << "submit: " << error << "\n";
+        return 1;
+    }
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < scenarios.size(); ++i) {
+        ServiceRequest request;
+        request.jobId = i;
+        request.priority = priority;
+        request.precision = precisionOverride;
+        request.confidence = confidenceOverride;
+        request.scenarioText = scenarios[i]->text;
+        if (!sendMessage(fd, WireType::Submit, request.encode())) {
+            cerr << "submit: the service closed the connection\n";
+            close(fd);
+            return 1;
+        }
+    }
+
+    vector<ServiceAnswer> answers(scenarios.size());
+    vector<double> seconds(scenarios.size(), 0.0);
+    vector<bool> answered(scenarios.size(), false);
+    size_t pending = scenarios.size();
+    bool cancelled = false;
+    while (pending > 0) {
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        int wait = -1;
+        if (timeout > 0 && !cancelled) wait = static_cast<int>(max(0.0, timeout - elapsed) * 1000);
+        pollfd polled = { fd, POLLIN, 0 };
+        int ready = poll(&polled, 1, wait);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready == 0) {
+            for (size_t i = 0; i < answered.size(); ++i) {
+                uint64_t jobId = i;
+                if (!answered[i]) sendMessage(fd, WireType::Cancel, string(reinterpret_cast<const char*>(&jobId), sizeof(jobId)));
+            }
+            cancelled = true;
+            continue;
+        }
+        WireType type;
+        string payload;
+        ServiceAnswer answer;
+        if (ready < 0 || !receiveMessage(fd, type, payload) || type != WireType::Answer || !answer.decode(payload) ||
+            answer.jobId >= answers.size() || answered[answer.jobId]) {
+            cerr << "submit: lost the connection to the service\n";
+            close(fd);
+            return 1;
+        }
+        answers[answer.jobId] = answer;
+        answered[answer.jobId] = true;
+        seconds[answer.jobId] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        pending--;
+    }
+    close(fd);
+
+    if (format == OutputFormat::Csv) {
+        cout << "scenario,group1Size,group2Size,rounds,seed,threads,group1Wins,group2Wins,"
+                "group1WinProbability,group2WinProbability,confidence,group1WinLower,group1WinUpper,seconds\n";
+    }
+    for (size_t i = 0; i < scenarios.size(); ++i) {
+        const ServiceAnswer& answer = answers[i];
+        if (answer.status == ServiceStatus::Done) {
+            writeBatchResult(cout, format, *scenarios[i], answer.seed, answer.threads, answer.tally, seconds[i]);
+            continue;
+        }
+        cerr << scenarios[i]->source << ": " << (answer.status == ServiceStatus::Cancelled ? string("cancelled") : answer.error) << "\n";
+        failures++;
+    }
+    cout.flush();
+    return failures == 0 ? 0 : 1;
+}
+#endif
+
+// Prints the profile and writes the trace, if profiling was switched on; passes the exit status through.
+int finishProfiling(int status, const string& tracePath) {
+    if (!profilingEnabled()) return status;
+    writeProfileReport(cerr);
+    string error;
+    if (!tracePath.empty() && !writeChromeTrace(tracePath, error)) {
+        cerr << error << "\n";
+        return 1;
+    }
+    return status;
+}
+
+void printUsage(const char* program) {
+    cerr << "Usage: " << program << " [options] scenario...\n"
+         << "Runs every scenario file ('-' reads stdin) without the interactive menu.\n"
+         << "  --format json|csv   result format, one record per scenario (default json)\n"
+         << "  --threads N         worker threads, overrides the scenario (default: all cores)\n"
+         << "  --precision E       keep simulating until group 1's win rate is known to +-E (e.g. 0.005)\n"
+         << "  --confidence C      confidence level for intervals (default 0.95)\n"
+         << "  --simd MODE         widest round engine: auto|scalar|avx2|avx512 (default auto)\n"
+         << "  --stats             add turn, survivor, damage and spell statistics (slower: no SIMD)\n"
+         << "  --checkpoint FILE   save progress to FILE every --checkpoint-every rounds (default 10000000)\n"
+         << "  --resume            continue from the --checkpoint file instead of starting over\n"
+         << "  --replay K          play only round K (0-based) with the full combat log; needs a seed\n"
+         << "  --coordinate ADDR   hand the rounds to workers connecting to ADDR (unix:PATH or HOST:PORT)\n"
+         << "  --local-workers K   with --coordinate, also start K worker processes on this machine\n"
+         << "  --shard-rounds N    rounds per shard handed to a worker (default 1000000)\n"
+         << "  --shard-timeout S   re-queue a shard whose worker has not answered in S seconds (default 600)\n"
+         << "  --worker-timeout S  fail a coordinated run after S seconds without any connected worker (default 60)\n"
+         << "  --worker ADDR       run as a worker for the coordinator at ADDR; takes no scenario\n"
+         << "  --serve ADDR        run as a simulation service on ADDR with a shared pool (--threads) and result cache\n"
+         << "  --cache N           results the service keeps (default 4096)\n"
+         << "  --submit ADDR       send the scenarios to the service at ADDR and print its answers\n"
+         << "  --priority P        with --submit, higher priorities are scheduled first (default 0)\n"
+         << "  --timeout S         with --submit, cancel whatever is still running after S seconds\n"
+         << "  --results FILE      also write every result to FILE as a binary result table\n"
+         << "  --show-results FILE print a binary result table as CSV and exit\n"
+         << "  --save-roster FILE  convert the scenario's units to a binary roster for 'roster FILE' lines\n"
+         << "  --sweep FILE        simulate every cell of the scenario's sweep lines, write the cube to FILE\n"
+         << "  --profile           print per-phase cycle counts and engine event counts to stderr (scalar engine)\n"
+         << "  --trace FILE        with profiling, also write a Chrome trace (chrome://tracing, Perfetto) to FILE\n"
+         << "  --exact             solve small matchups (up to 4v4) exactly instead of simulating them\n"
+         << "  --oracle            simulate as usual and compare the estimate with the exact solution\n"
+         << "  --optimize          search the best group 1 build against group 2 (uses team-size, level-cap)\n"
+         << "\nScenario lines:\n"
+         << "  rounds N            with precision set, this is the round cap\n"
+         << "  precision E\n  confidence C\n  seed N\n  threads N\n  team-size N\n  level-cap N         at most 100\n"
+         << "  strategy <1|2> lowest-hp|highest-hp|lowest-damage|highest-damage\n"
+         << "  unit <1|2> warrior|archer|mage <level 1-100> [weapon|none] [armor|none] [name]\n"
+         << "  roster FILE         take both groups from a binary roster instead of unit lines\n"
+         << "  sweep level <1|2> FROM TO [STEP] | sweep equipment <1|2> | sweep strategy <1|2>   (up to 4, 1e6 cells)\n"
+         << "  positional [SPACING [GAP]]   units fight in formation with weapon range (default 1 10)\n"
+         << "  spells first|strongest|weighted   which spell a unit casts: its first (default), the strongest it can\n"
+         << "                      cast now, or a random one weighted by damage per mana; spells have cooldowns\n"
+         << "  decided E           a sweep cell stops once its interval is within E of 0 or 1 (default 0.01)\n";
+}
+
+int runBatchCli(int argc, char* argv[]) {
+    OutputFormat format = OutputFormat::Json;
+    int threadOverride = 0;
+    bool optimize = false;
+    bool collectStats = false;
+    string checkpointPath;
+    long long checkpointEvery = 10000000;
+    bool resume = false;
+    long long replayIndex = -1;
+    string coordinateAddress;
+    string workerAddress;
+    string serveAddress;
+    string submitAddress;
+    int priority = 0;
+    double timeout = 0.0;
+    size_t cacheSize = 4096;
+    int localWorkers = 0;
+    long long shardRounds = 1000000;
+    double shardTimeout = 600.0;
+    double workerTimeout = 60.0;
+    string resultsPath;
+    string rosterOutput;
+    string sweepPath;
+    bool profile = false;
+    bool exactMode = false;
+    bool oracle = false;
+    string tracePath;
+    double precisionOverride = 0.0;
+    double confidenceOverride = 0.0;
+    vector<string> paths;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--format" && i + 1 < argc) {
+            string value = argv[++i];
+            if (value == "json") format = OutputFormat::Json;
+            else if (value == "csv") format = OutputFormat::Csv;
+            else {
+                printUsage(argv[0]);
+                return 2;
+            }
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threadOverride = atoi(argv[++i]);
+        } else if (arg == "--precision" && i + 1 < argc) {
+            precisionOverride = atof(argv[++i]);
+            if (precisionOverride <= 0 || precisionOverride >= 0.5) {
+                printUsage(argv[0]);
+                return 2;
+            }
+        } else if (arg == "--confidence" && i + 1 < argc) {
+            confidenceOverride = atof(argv[++i]);
+            if (confidenceOverride <= 0 || confidenceOverride >= 1) {
+                printUsage(argv[0]);
+                return 2;
+            }
+        } else if (arg == "--simd" && i + 1 < argc) {
+            string value = argv[++i];
+            SimdLevel requested;
+            if (value == "auto") requested = detectSimdLevel();
+            else if (value == "scalar") requested = SimdLevel::Scalar;
+            else if (value == "avx2") requested = SimdLevel::Avx2;
+            else if (value == "avx512") requested = SimdLevel::Avx512;
+            else {
+                printUsage(argv[0]);
+                return 2;
+            }
+            simdLimit() = min(requested, detectSimdLevel());
+        } else if (arg == "--optimize") {
+            optimize = true;
+        } else if (arg == "--stats") {
+            collectStats = true;
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpointPath = argv[++i];
+        } else if (arg == "--checkpoint-every" && i + 1 < argc) {
+            checkpointEvery = atoll(argv[++i]);
+            if (checkpointEvery <= 0) {
+                printUsage(argv[0]);
+                return 2;
+            }
+        } else if (arg == "--coordinate" && i + 1 < argc) {
+            coordinateAddress = argv[++i];
+        } else if (arg == "--worker" && i + 1 < argc) {
+            workerAddress = argv[++i];
+        } else if (arg == "--serve" && i + 1 < argc) {
+            serveAddress = argv[++i];
+        } else if (arg == "--submit" && i + 1 < argc) {
+            submitAddress = argv[++i];
+        } else if (arg == "--priority" && i + 1 < argc) {
+            priority = atoi(argv[++i]);
+        } else if (arg == "--timeout" && i + 1 < argc) {
+            timeout = atof(argv[++i]);
+            if (timeout <= 0) {
+                printUsage(argv[0]);
+                return 2;
+            }
+        } else if (arg == "--cache" && i + 1 < argc) {
+            cacheSize = static_cast<size_t>(max(1LL, atoll(argv[++i])));
+        } else if (arg == "--local-workers" && i + 1 < argc) {
+            localWorkers = max(0, atoi(argv[++i]));
+        } else if (arg == "--shard-rounds" && i + 1 < argc) {
+            shardRounds = atoll(argv[++i]);
+            if (shardRounds <= 0) {
+                printUsage(argv[0]);
+                return 2;
+            }
+        } else if (arg == "--shard-timeout" && i + 1 < argc) {
+            shardTimeout = atof(argv[++i]);
+            if (shardTimeout <= 0) {
+                printUsage(argv[0]);
+                return 2;
+            }
+        } else if (arg == "--worker-timeout" && i + 1 < argc) {
+            workerTimeout = atof(argv[++i]);
+            if (workerTimeout <= 0) {
+                printUsage(argv[0]);
+                return 2;
+            }
+        } else if (arg == "--results" && i + 1 < argc) {
+            resultsPath = argv[++i];
+        } else if (arg == "--show-results" && i + 1 < argc) {
+            ResultTable table;
+            string error;
+            if (!table.load(argv[++i], error)) {
+                cerr << error << "\n";
+                return 1;
+            }
+            table.writeCsv(cout);
+            return 0;
+        } else if (arg == "--exact") {
+            exactMode = true;
+        } else if (arg == "--oracle") {
+            oracle = true;
+        } else if (arg == "--profile") {
+            profile = true;
+        } else if (arg == "--trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+            profile = true;
+        } else if (arg == "--sweep" && i + 1 < argc) {
+            sweepPath = argv[++i];
+        } else if (arg == "--save-roster" && i + 1 < argc) {
+            rosterOutput = argv[++i];
+        } else if (arg == "--resume") {
+            resume = true;
+        } else if (arg == "--replay" && i + 1 < argc) {
+            replayIndex = atoll(argv[++i]);
+            if (replayIndex < 0) {
+                printUsage(argv[0]);
+                return 2;
+            }
+        } else if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (arg.size() > 1 && arg[0] == '-' && arg[1] == '-') {
+            printUsage(argv[0]);
+            return 2;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+
+    if (!workerAddress.empty() || !coordinateAddress.empty() || !serveAddress.empty() || !submitAddress.empty()) {
+#if LAB1_HAS_SOCKETS
+        if (profile || exactMode || oracle) {
+            cerr << "--profile, --trace, --exact and --oracle are local only; run them without --coordinate, --serve or --submit\n";
+            return 2;
+        }
+        if (!serveAddress.empty()) {
+            return runService(serveAddress, threadOverride > 0 ? threadOverride : defaultThreadCount(), cacheSize);
+        }
+        if (!submitAddress.empty()) {
+            if (paths.empty() || optimize || collectStats || !checkpointPath.empty() || replayIndex >= 0) {
+                cerr << "--submit needs scenarios; it cannot be combined with --optimize, --stats, --checkpoint or --replay\n";
+                return 2;
+            }
+            return runSubmitCli(paths, format, submitAddress, priority, precisionOverride, confidenceOverride, timeout);
+        }
+        if (!workerAddress.empty()) {
+            return runWorker(workerAddress, threadOverride > 0 ? threadOverride : defaultThreadCount());
+        }
+        if (paths.empty() || optimize || !checkpointPath.empty() || replayIndex >= 0 || precisionOverride > 0) {
+            cerr << "--coordinate needs scenarios and fixed round counts; it cannot be combined with "
+                    "--optimize, --checkpoint, --replay or --precision\n";
+            return 2;
+        }
+        return runCoordinatorCli(paths, format, collectStats, coordinateAddress, localWorkers, shardRounds, shardTimeout,
+                                 workerTimeout, threadOverride, resultsPath);
+#else
+        cerr << "--coordinate, --worker, --serve and --submit need POSIX sockets, which this build does not have\n";
+        return 2;
+#endif
+    }
+
+    if (paths.empty() || (resume && checkpointPath.empty())) {
+        printUsage(argv[0]);
+        return 2;
+    }
+    if (!checkpointPath.empty() && (paths.size() != 1 || optimize)) {
+        cerr << "--checkpoint takes exactly one scenario and cannot be combined with --optimize\n";
+        return 2;
+    }
+
+    if (!rosterOutput.empty()) {
+        Scenario scenario;
+        string error;
+        if (paths.size() != 1 || !loadScenario(paths[0], scenario, error)) {
+            cerr << (paths.size() != 1 ? string("--save-roster takes exactly one scenario") : paths[0] + ": " + error) << "\n";
+            return 2;
+        }
+        if (!materializeScenario(scenario)) {
+            cerr << paths[0] << ": " << BadRosterError << "\n";
+            return 1;
+        }
+        if (!saveRoster(rosterOutput, scenario.group1, scenario.group2, error)) {
+            cerr << error << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    if (profile) {
+        if (LAB1_PROFILE == 0) {
+            cerr << "--profile and --trace need a build with LAB1_PROFILE=1\n";
+            return 2;
+        }
+        startProfiling(!tracePath.empty());
+    }
+
+    if (!sweepPath.empty()) {
+        Scenario scenario;
+        string error;
+        if (paths.size() != 1 || optimize || !checkpointPath.empty() || replayIndex >= 0) {
+            cerr << "--sweep takes exactly one scenario and cannot be combined with --optimize, --checkpoint or --replay\n";
+            return 2;
+        }
+        if (!loadScenario(paths[0], scenario, error)) {
+            cerr << paths[0] << ": " << error << "\n";
+            return 1;
+        }
+        if (!materializeScenario(scenario)) {
+            cerr << paths[0] << ": " << BadRosterError << "\n";
+            return 1;
+        }
+        if (scenario.sweep.empty() || scenario.group1.empty() || scenario.group2.empty()) {
+            cerr << paths[0] << ": a sweep needs 'sweep' lines and units in both groups\n";
+            return 1;
+        }
+        SweepSettings settings;
+        settings.rounds = scenario.rounds;
+        settings.precision = precisionOverride > 0 ? precisionOverride : scenario.precision;
+        settings.decided = scenario.decided;
+        settings.positional = scenario.positional;
+        settings.spellPolicy = scenario.spellPolicy;
+        settings.spacing = scenario.spacing;
+        settings.gap = scenario.gap;
+        settings.z = confidenceToZ(confidenceOverride > 0 ? confidenceOverride : scenario.confidence);
+        settings.seed = scenario.hasSeed ? scenario.seed : randomSeed();
+        settings.threads = threadOverride > 0 ? threadOverride : (scenario.threads > 0 ? scenario.threads : defaultThreadCount());
+        vector<BuildUnit> base[2] = { buildUnitsOf(scenario.group1), buildUnitsOf(scenario.group2) };
+
+        auto start = chrono::steady_clock::now();
+        ResultTable cube;
+        SweepSummary summary = runSweep(base, scenario.strategy, scenario.sweep, settings, cube);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (!cube.save(sweepPath, error)) {
+            cerr << error << "\n";
+            return 1;
+        }
+        writeSweepResult(cout, scenario, settings, summary, sweepPath, seconds);
+        cout.flush();
+        return finishProfiling(0, tracePath);
+    }
+
+    ios::sync_with_stdio(false);
+    if (format == OutputFormat::Csv && !optimize) {
+        cout << "scenario,group1Size,group2Size,rounds,seed,threads,group1Wins,group2Wins,"
+                "group1WinProbability,group2WinProbability,confidence,group1WinLower,group1WinUpper,seconds";
+        if (collectStats) cout << ",turnsMean,turnsP50,turnsP90,turnsP99,group1SurvivorsMean,group2SurvivorsMean";
+        if (exactMode || oracle) cout << ",exactProbability,exactDeviation";
+        cout << "\n";
+    }
+
+    int failures = 0;
+    ResultTable results;
+    for (const string& path : paths) {
+        Scenario scenario;
+        string error;
+        if (!loadScenario(path, scenario, error)) {
+            cerr << path << ": " << error << "\n";
+            failures++;
+            continue;
+        }
+
+        if (precisionOverride > 0) scenario.precision = precisionOverride;
+        if (confidenceOverride > 0) scenario.confidence = confidenceOverride;
+        uint64_t seed = scenario.hasSeed ? scenario.seed : randomSeed();
+        int threads = threadOverride > 0 ? threadOverride : (scenario.threads > 0 ? scenario.threads : defaultThreadCount());
+        auto start = chrono::steady_clock::now();
+
+        if (optimize) {
+            if (!materializeScenario(scenario)) {
+                cerr << path << ": " << BadRosterError << "\n";
+                failures++;
+                continue;
+            }
+            if (scenario.group2.empty()) {
+                cerr << path << ": group 2 must have at least one unit to optimize against\n";
+                failures++;
+                continue;
+            }
+            OptimizerSettings settings;
+            settings.teamSize = scenario.teamSize > 0 ? scenario.teamSize : max(1, static_cast<int>(scenario.group1.size()));
+            settings.levelCap = scenario.levelCap;
+            settings.seed = seed;
+            settings.threads = threads;
+            OptimizerResult result = optimizeBuild(scenario.group2, scenario.strategy[1], settings);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            writeOptimizerResult(cout, scenario, settings, result, seconds);
+            continue;
+        }
+
+        if (scenarioGroupSize(scenario, 0) == 0 || scenarioGroupSize(scenario, 1) == 0) {
+            cerr << path << ": both groups must have at least one unit\n";
+            failures++;
+            continue;
+        }
+
+        if (replayIndex >= 0) {
+            if (!scenario.hasSeed) {
+                cerr << path << ": --replay needs a fixed 'seed' line in the scenario\n";
+                failures++;
+                continue;
+            }
+            if (!materializeScenario(scenario)) {
+                cerr << path << ": " << BadRosterError << "\n";
+                failures++;
+                continue;
+            }
+            replayRound(scenario, scenario.seed, replayIndex);
+            continue;
+        }
+
+        CombatState initial;
+        if (!scenarioState(scenario, initial)) {
+            cerr << path << ": " << BadRosterError << "\n";
+            failures++;
+            continue;
+        }
+        RoundTally tally;
+        BattleStats stats;
+        stats.reset(initial.unitCount);
+        BattleStats* statsOut = collectStats ? &stats : nullptr;
+        ExactResult exact;
+        if (exactMode || oracle) exact = solveExact(initial);
+        const ExactResult* exactOut = exactMode || oracle ? &exact : nullptr;
+        // Stats and checkpoints need the rounds themselves, so those runs simulate even when a solution exists.
+        if (exactMode && !oracle && exact.solved && !collectStats && checkpointPath.empty()) {
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            writeBatchResult(cout, format, scenario, seed, threads, tally, seconds, nullptr, exactOut);
+            results.add(initial.fingerprint(), seed, tally, { exact.probability, exact.probability, exact.probability });
+            continue;
+        }
+        if (!checkpointPath.empty()) {
+            if (scenario.precision > 0) {
+                cerr << path << ": --checkpoint needs a fixed round count, not precision\n";
+                failures++;
+                continue;
+            }
+            Checkpoint checkpoint;
+            checkpoint.scenarioHash = initial.fingerprint();
+            checkpoint.seed = seed;
+            checkpoint.totalRounds = scenario.rounds;
+            checkpoint.hasStats = collectStats;
+            if (resume) {
+                Checkpoint saved;
+                if (!readCheckpoint(checkpointPath, saved, error)) {
+                    cerr << path << ": " << error << "\n";
+                    failures++;
+                    continue;
                 }
-                cout << "\n--- Group 2 ---\n";
-                for (const Character* character : group2) {
-                    character->display();
-                    cout << endl;
+                if (saved.scenarioHash != checkpoint.scenarioHash || saved.totalRounds != checkpoint.totalRounds ||
+                    saved.hasStats != collectStats || (scenario.hasSeed && saved.seed != seed)) {
+                    cerr << path << ": checkpoint " << checkpointPath << " was written for a different run\n";
+                    failures++;
+                    continue;
                 }
-                break;
+                checkpoint = saved;
+                seed = saved.seed;
+                if (collectStats) stats = saved.stats;
             }
-            case 4: {
-                if (group1.empty() || group2.empty()) {
-                    cout << "Both groups must have at least one character to start the battle!\n";
-                } else {
-                    int rounds = getValidatedInput("Enter the number of rounds for the battle: ", 1, 100);
-                    int logChoice = getValidatedInput("Do you want a detailed battle log? (1 for Yes, 0 for No): ", 0, 1);
-                    bool showLog = logChoice == 1;
-                    battleSimulation(graph, group1, group2, strategy, rounds, showLog);
-                }
-                break;
+
+            while (checkpoint.nextRound < checkpoint.totalRounds) {
+                long long chunk = min(checkpointEvery, checkpoint.totalRounds - checkpoint.nextRound);
+                RoundTally part = runRoundsParallel(initial, chunk, seed, threads, checkpoint.nextRound, statsOut);
+                checkpoint.tally.group1Wins += part.group1Wins;
+                checkpoint.tally.group2Wins += part.group2Wins;
+                checkpoint.nextRound += chunk;
+                if (collectStats) checkpoint.stats = stats;
+                if (!writeCheckpoint(checkpointPath, checkpoint, error)) break;
             }
-            case 5:
-                strategy = chooseFocusStrategy();
-                break;
-            case 6:
-                cout << "Exiting the program. Goodbye!\n";
-                break;
+            // A failed write leaves only part of the rounds played; that tally is not a result.
+            if (checkpoint.nextRound < checkpoint.totalRounds) {
+                cerr << path << ": " << error << "\n";
+                failures++;
+                continue;
+            }
+            tally = checkpoint.tally;
+        } else if (scenario.precision > 0) {
+            long long maxRounds = scenario.hasRounds ? scenario.rounds : 1000000000LL;
+            tally = runUntilPrecise(initial, scenario.precision, confidenceToZ(scenario.confidence), maxRounds, seed, threads, statsOut);
+        } else {
+            tally = runRoundsParallel(initial, scenario.rounds, seed, threads, 0, statsOut);
         }
-    } while (choice != 6);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-    for (Character* character : group1) {
-        delete character;
+        writeBatchResult(cout, format, scenario, seed, threads, tally, seconds, statsOut, exactOut);
+        results.add(initial.fingerprint(), seed, tally,
+                    wilsonInterval(tally.group1Wins, tally.group1Wins + tally.group2Wins, confidenceToZ(scenario.confidence)));
     }
-    for (Character* character : group2) {
-        delete character;
+    cout.flush();
+    if (!resultsPath.empty()) {
+        string error;
+        if (!results.save(resultsPath, error)) {
+            cerr << error << "\n";
+            failures++;
+        }
     }
+    return finishProfiling(failures == 0 ? 0 : 1, tracePath);
 }
 
-int main() {
+#ifndef LAB1_NO_MAIN
+int main(int argc, char* argv[]) {
     srand(static_cast<unsigned>(time(0)));
+    if (argc > 1) {
+        return runBatchCli(argc, argv);
+    }
     mainMenu();
     return 0;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,404 @@
+#include <benchmark/benchmark.h>
+
+#include "Lab1.cpp"
+
+static const EquipmentCatalog& benchCatalog() {
+    static const EquipmentCatalog catalog;
+    return catalog;
+}
+
+static vector<Character*> makeGroup(BattleArena& arena, int size, uint64_t seed) {
+    mt19937_64 random(seed);
+    vector<Character*> group;
+    for (int i = 0; i < size; ++i) {
+        CharacterClass characterClass = static_cast<CharacterClass>(random() % 3);
+        int level = 5 + static_cast<int>(random() % 20);
+        int weapon = static_cast<int>(random() % (Weapon::getWeaponList().size() + 1)) - 1;
+        int armor = static_cast<int>(random() % (Armor::getArmorList().size() + 1)) - 1;
+        group.push_back(createCharacterOfClass(arena, characterClass, "u" + to_string(i), level,
+                                               benchCatalog().weapon(weapon), benchCatalog().armor(armor)));
+    }
+    return group;
+}
+
+static void BM_FindTarget(benchmark::State& state) {
+    BattleArena arena;
+    FocusStrategy strategy = static_cast<FocusStrategy>(state.range(0));
+    vector<Character*> attackers = makeGroup(arena, 1, 1);
+    vector<Character*> enemies = makeGroup(arena, static_cast<int>(state.range(1)), 2);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(findTarget(attackers[0], enemies, strategy));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(1));
+}
+BENCHMARK(BM_FindTarget)->ArgsProduct({ { 0, 1, 2, 3 }, { 5, 50, 500 } })->ArgNames({ "strategy", "enemies" });
+
+static void BM_ReduceDamage(benchmark::State& state) {
+    Armor armor("Plate Armor", 7);
+    int incoming = 1;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(armor.reduceDamage(incoming));
+        incoming = (incoming & 255) + 1;
+    }
+}
+BENCHMARK(BM_ReduceDamage);
+
+static void BM_TakeDamage(benchmark::State& state) {
+    Armor armor("Chainmail", 5);
+    Warrior target("target", 50, nullptr, &armor);
+    for (auto _ : state) {
+        target.takeDamage(17);
+        if (!target.isAlive()) target.resetHealth();
+    }
+}
+BENCHMARK(BM_TakeDamage);
+
+static void BM_CreateEdgesBasedOnCriteria(benchmark::State& state) {
+    BattleArena arena;
+    FocusStrategy strategy = static_cast<FocusStrategy>(state.range(0));
+    vector<Character*> group1 = makeGroup(arena, static_cast<int>(state.range(1)), 3);
+    vector<Character*> group2 = makeGroup(arena, static_cast<int>(state.range(1)), 4);
+    BattleGraph graph;
+
+    for (auto _ : state) {
+        graph.createEdgesBasedOnCriteria(group1, group2, strategy);
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_CreateEdgesBasedOnCriteria)->ArgsProduct({ { 0, 3 }, { 5, 50, 500 } })->ArgNames({ "strategy", "size" });
+
+static void buildRandomGraph(BattleGraph& graph, Character* unit, int vertices, int edges, uint64_t seed) {
+    mt19937_64 random(seed);
+    for (int v = 0; v < vertices; ++v) graph.addCharacter(unit);
+    while (graph.edgeCount() < edges) {
+        graph.addEdge(static_cast<int>(random() % vertices), static_cast<int>(random() % vertices), 1 + static_cast<int>(random() % 1000));
+    }
+}
+
+static void BM_SpanningTree(benchmark::State& state) {
+    bool prim = state.range(0) == 1;
+    int vertices = static_cast<int>(state.range(1));
+    int edges = static_cast<int>(state.range(2));
+    Warrior unit("unit", 1);
+    BattleGraph graph;
+    buildRandomGraph(graph, &unit, vertices, edges, 9);
+
+    for (auto _ : state) {
+        SpanningTree tree = prim ? graph.primSpanningTree(false) : graph.kruskalSpanningTree(false);
+        benchmark::DoNotOptimize(tree.totalWeight);
+    }
+    state.SetItemsProcessed(state.iterations() * edges);
+}
+BENCHMARK(BM_SpanningTree)->ArgsProduct({ { 0, 1 }, { 1000 }, { 10000 } })->ArgNames({ "prim", "vertices", "edges" });
+BENCHMARK(BM_SpanningTree)->ArgsProduct({ { 0, 1 }, { 100000 }, { 2000000 } })->ArgNames({ "prim", "vertices", "edges" })
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_ConnectedComponents(benchmark::State& state) {
+    int vertices = static_cast<int>(state.range(0));
+    int edges = static_cast<int>(state.range(1));
+    Warrior unit("unit", 1);
+    BattleGraph graph;
+    buildRandomGraph(graph, &unit, vertices, edges, 10);
+    vector<int> componentOf;
+
+    // Toggling an edge keeps the cached components from answering every iteration.
+    for (auto _ : state) {
+        if (!graph.removeEdge(0, 1)) graph.addEdge(0, 1, 1);
+        benchmark::DoNotOptimize(graph.connectedComponents(componentOf));
+    }
+    state.SetItemsProcessed(state.iterations() * edges);
+}
+BENCHMARK(BM_ConnectedComponents)->Args({ 100000, 2000000 })->ArgNames({ "vertices", "edges" })->Unit(benchmark::kMillisecond);
+
+static void BM_SameComponentPairs(benchmark::State& state) {
+    int vertices = static_cast<int>(state.range(0));
+    Warrior unit("unit", 1);
+    BattleGraph graph;
+    buildRandomGraph(graph, &unit, vertices, vertices / 2, 11);
+
+    for (auto _ : state) {
+        int connected = 0;
+        for (int a = 0; a < vertices; ++a) {
+            for (int b = a + 1; b < vertices; ++b) connected += graph.sameComponent(a, b);
+        }
+        benchmark::DoNotOptimize(connected);
+    }
+    state.SetItemsProcessed(state.iterations() * vertices * (vertices - 1) / 2);
+}
+BENCHMARK(BM_SameComponentPairs)->Arg(1000)->ArgName("vertices")->Unit(benchmark::kMillisecond);
+
+static void BM_CoinFlip(benchmark::State& state) {
+    BattleRng rng(42);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(rng.coinFlip());
+    }
+}
+BENCHMARK(BM_CoinFlip);
+
+static void BM_FillBits(benchmark::State& state) {
+    BattleRng rng(42);
+    vector<uint64_t> buffer(static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        rng.fillBits(buffer.data(), buffer.size());
+        benchmark::DoNotOptimize(buffer.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * state.range(0) * sizeof(uint64_t));
+}
+BENCHMARK(BM_FillBits)->Arg(16)->Arg(1024);
+
+static void BM_BattleRounds(benchmark::State& state) {
+    BattleArena arena;
+    FocusStrategy strategy = static_cast<FocusStrategy>(state.range(0));
+    int size = static_cast<int>(state.range(1));
+    vector<Character*> group1 = makeGroup(arena, size, 5);
+    vector<Character*> group2 = makeGroup(arena, size, 6);
+    CombatState initial = CombatState::build(group1, group2, strategy, strategy);
+    CombatState combat = initial;
+    BattleRng rng(42);
+    uint64_t round = 0;
+
+    for (auto _ : state) {
+        rng.startRound(round++);
+        benchmark::DoNotOptimize(playRound(combat, rng));
+    }
+    state.counters["rounds_per_second"] = benchmark::Counter(static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_BattleRounds)->ArgsProduct({ { 0, 1, 2, 3 }, { 1, 5, 50, 500 } })->ArgNames({ "strategy", "size" });
+
+static void BM_BattleRoundsSpecialized(benchmark::State& state) {
+    BattleArena arena;
+    FocusStrategy strategy = static_cast<FocusStrategy>(state.range(0));
+    int size = static_cast<int>(state.range(1));
+    vector<Character*> group1 = makeGroup(arena, size, 5);
+    vector<Character*> group2 = makeGroup(arena, size, 6);
+    CombatState combat = CombatState::build(group1, group2, strategy, strategy);
+    RoundFunction play = roundFunctionFor(combat);
+    BattleRng rng(42);
+    uint64_t round = 0;
+
+    for (auto _ : state) {
+        rng.startRound(round++);
+        benchmark::DoNotOptimize(play(combat, rng, nullptr));
+    }
+    state.counters["rounds_per_second"] = benchmark::Counter(static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_BattleRoundsSpecialized)->ArgsProduct({ { 0, 1, 2, 3 }, { 1, 5, 50, 500 } })->ArgNames({ "strategy", "size" });
+
+static void BM_BattleRoundsSimd(benchmark::State& state) {
+    SimdLevel level = static_cast<SimdLevel>(state.range(0));
+    if (level > detectSimdLevel()) {
+        state.SkipWithError("instruction set not supported by this CPU");
+        return;
+    }
+    BattleArena arena;
+    int size = static_cast<int>(state.range(1));
+    vector<Character*> group1 = makeGroup(arena, size, 5);
+    vector<Character*> group2 = makeGroup(arena, size, 6);
+    CombatState initial = CombatState::build(group1, group2, FocusStrategy::LowestHP, FocusStrategy::LowestHP);
+    const long long rounds = 4096;
+    long long firstRound = 0;
+
+    SimdLevel saved = simdLimit();
+    simdLimit() = level;
+    for (auto _ : state) {
+        RoundTally tally;
+        runRoundBlock(initial, firstRound, rounds, 42, tally);
+        benchmark::DoNotOptimize(tally);
+        firstRound += rounds;
+    }
+    simdLimit() = saved;
+    state.counters["rounds_per_second"] = benchmark::Counter(static_cast<double>(state.iterations() * rounds), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_BattleRoundsSimd)->ArgsProduct({ { 0, 1, 2 }, { 1, 3, 5, 16 } })->ArgNames({ "simd", "size" });
+
+static void BM_BattleRoundsWithStats(benchmark::State& state) {
+    BattleArena arena;
+    int size = static_cast<int>(state.range(0));
+    vector<Character*> group1 = makeGroup(arena, size, 5);
+    vector<Character*> group2 = makeGroup(arena, size, 6);
+    CombatState initial = CombatState::build(group1, group2, FocusStrategy::LowestHP, FocusStrategy::LowestHP);
+    const long long rounds = 4096;
+    long long firstRound = 0;
+    BattleStats stats;
+    stats.reset(initial.unitCount);
+
+    for (auto _ : state) {
+        RoundTally tally;
+        runRoundBlock(initial, firstRound, rounds, 42, tally, &stats);
+        benchmark::DoNotOptimize(tally);
+        firstRound += rounds;
+    }
+    state.counters["rounds_per_second"] = benchmark::Counter(static_cast<double>(state.iterations() * rounds), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_BattleRoundsWithStats)->Arg(5)->Arg(50)->ArgName("size");
+
+static void BM_BattleRoundsParallel(benchmark::State& state) {
+    BattleArena arena;
+    int size = static_cast<int>(state.range(0));
+    vector<Character*> group1 = makeGroup(arena, size, 7);
+    vector<Character*> group2 = makeGroup(arena, size, 8);
+    CombatState initial = CombatState::build(group1, group2, FocusStrategy::LowestHP, FocusStrategy::LowestHP);
+    const long long rounds = 4096;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(runRoundsParallel(initial, rounds, 42, defaultThreadCount()));
+    }
+    state.counters["rounds_per_second"] = benchmark::Counter(static_cast<double>(state.iterations() * rounds), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_BattleRoundsParallel)->Arg(1)->Arg(5)->Arg(50)->Arg(500)->ArgName("size")->UseRealTime();
+
+static void BM_RosterLoad(benchmark::State& state) {
+    BattleArena arena;
+    int size = static_cast<int>(state.range(1));
+    vector<Character*> group1 = makeGroup(arena, size, 9);
+    vector<Character*> group2 = makeGroup(arena, size, 10);
+    string path = "bench_roster.bin", error;
+    if (!saveRoster(path, group1, group2, error)) {
+        state.SkipWithError(error.c_str());
+        return;
+    }
+    ColumnFile roster;
+    roster.open(path, RosterMagic, RosterVersion, error);
+
+    for (auto _ : state) {
+        CombatState loaded;
+        if (state.range(0) == 1) loadRosterState(roster, FocusStrategy::LowestHP, FocusStrategy::LowestHP, loaded);
+        else loaded = CombatState::build(group1, group2, FocusStrategy::LowestHP, FocusStrategy::LowestHP);
+        benchmark::DoNotOptimize(loaded.unitCount);
+    }
+    remove(path.c_str());
+    state.SetItemsProcessed(state.iterations() * size * 2);
+}
+BENCHMARK(BM_RosterLoad)->ArgsProduct({ { 0, 1 }, { 50, 5000 } })->ArgNames({ "mapped", "size" });
+
+static void BM_Sweep(benchmark::State& state) {
+    BattleArena arena;
+    vector<BuildUnit> base[2] = { buildUnitsOf(makeGroup(arena, 5, 11)), buildUnitsOf(makeGroup(arena, 5, 12)) };
+    FocusStrategy strategy[2] = { FocusStrategy::LowestHP, FocusStrategy::LowestHP };
+    vector<SweepAxis> axes = { { SweepAxisKind::Level, 1, 1, 10, 10 }, { SweepAxisKind::Equipment, 1, 0, 1, 25 } };
+    SweepSettings settings;
+    settings.rounds = 2048;
+    settings.decided = state.range(0) / 100.0;
+    settings.threads = defaultThreadCount();
+    long long rounds = 0;
+
+    for (auto _ : state) {
+        ResultTable cube;
+        rounds += runSweep(base, strategy, axes, settings, cube).roundsSimulated;
+        benchmark::DoNotOptimize(cube.group1Wins.data());
+    }
+    state.counters["cells_per_second"] = benchmark::Counter(static_cast<double>(state.iterations() * 250), benchmark::Counter::kIsRate);
+    state.counters["rounds_per_cell"] = static_cast<double>(rounds) / (state.iterations() * 250);
+}
+BENCHMARK(BM_Sweep)->Arg(0)->Arg(1)->ArgName("decided_percent")->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_BattleRoundsProfiled(benchmark::State& state) {
+    BattleArena arena;
+    vector<Character*> group1 = makeGroup(arena, 5, 13);
+    vector<Character*> group2 = makeGroup(arena, 5, 14);
+    CombatState initial = CombatState::build(group1, group2, FocusStrategy::LowestHP, FocusStrategy::LowestHP);
+    const long long rounds = 4096;
+    long long firstRound = 0;
+    profilingEnabled() = state.range(0) == 1;
+
+    for (auto _ : state) {
+        RoundTally tally;
+        runRoundBlock(initial, firstRound, rounds, 42, tally);
+        benchmark::DoNotOptimize(tally);
+        firstRound += rounds;
+    }
+    profilingEnabled() = false;
+    state.counters["rounds_per_second"] = benchmark::Counter(static_cast<double>(state.iterations() * rounds), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_BattleRoundsProfiled)->Arg(0)->Arg(1)->ArgName("profile");
+
+static void BM_PositionalRound(benchmark::State& state) {
+    BattleArena arena;
+    int size = static_cast<int>(state.range(0));
+    vector<Character*> group1 = makeGroup(arena, size, 15);
+    vector<Character*> group2 = makeGroup(arena, size, 16);
+    CombatState battle = CombatState::build(group1, group2, FocusStrategy::LowestHP, FocusStrategy::LowestHP);
+    battle.deploy(1.0f, 10.0f);
+    BattleRng rng(42);
+    long long round = 0, turns = 0;
+
+    for (auto _ : state) {
+        rng.startRound(round++);
+        benchmark::DoNotOptimize(playPositionalRound(battle, rng, nullptr));
+        turns += battle.turns;
+    }
+    state.counters["unit_turns_per_second"] = benchmark::Counter(static_cast<double>(turns) * 2 * size, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_PositionalRound)->Arg(100)->Arg(1000)->Arg(10000)->ArgName("size")->Unit(benchmark::kMillisecond);
+
+static void BM_ExactSolve(benchmark::State& state) {
+    BattleArena arena;
+    int size = static_cast<int>(state.range(0));
+    vector<Character*> group1 = makeGroup(arena, size, 17);
+    vector<Character*> group2 = makeGroup(arena, size, 18);
+    CombatState initial = CombatState::build(group1, group2, FocusStrategy::LowestHP, FocusStrategy::HighestDamage);
+    long long states = 0;
+
+    for (auto _ : state) {
+        ExactResult result = solveExact(initial);
+        benchmark::DoNotOptimize(result.probability);
+        states = result.states;
+    }
+    state.counters["states"] = static_cast<double>(states);
+}
+BENCHMARK(BM_ExactSolve)->Arg(1)->Arg(2)->Arg(3)->Arg(4)->ArgName("size")->Unit(benchmark::kMicrosecond);
+
+static void BM_SpellPolicy(benchmark::State& state) {
+    BattleArena arena;
+    vector<Character*> group1 = makeGroup(arena, 20, 19);
+    vector<Character*> group2 = makeGroup(arena, 20, 20);
+    CombatState initial = CombatState::build(group1, group2, FocusStrategy::LowestHP, FocusStrategy::HighestDamage);
+    initial.spellPolicy = static_cast<SpellPolicy>(state.range(0));
+    const long long rounds = 4096;
+    long long firstRound = 0;
+
+    for (auto _ : state) {
+        RoundTally tally;
+        runRoundBlock(initial, firstRound, rounds, 42, tally);
+        benchmark::DoNotOptimize(tally);
+        firstRound += rounds;
+    }
+    state.counters["rounds_per_second"] = benchmark::Counter(static_cast<double>(state.iterations() * rounds), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_SpellPolicy)->Arg(0)->Arg(1)->Arg(2)->ArgName("policy");
+
+#if LAB1_HAS_SOCKETS
+// The service's answer path for a repeated query: parse the scenario, build and hash the matchup, look it up.
+static void BM_ServiceCacheHit(benchmark::State& state) {
+    string text = "rounds 100000\nstrategy 2 highest-damage\n";
+    for (int side = 1; side <= 2; ++side) {
+        for (int i = 0; i < state.range(0); ++i) text += "unit " + to_string(side) + " mage " + to_string(10 + i) + "\n";
+    }
+    ResultCache cache(4096);
+    for (uint64_t key = 0; key < 4096; ++key) cache.store(key * 0x9E3779B97F4A7C15ULL, ServiceAnswer());
+    {
+        Scenario scenario;
+        istringstream in(text);
+        string error;
+        parseScenario(in, scenario, error);
+        CombatState initial;
+        scenarioState(scenario, initial);
+        cache.store(serviceKey(initial, scenario), ServiceAnswer());
+    }
+
+    for (auto _ : state) {
+        Scenario scenario;
+        istringstream in(text);
+        string error;
+        parseScenario(in, scenario, error);
+        ServiceAnswer answer;
+        CombatState initial;
+        scenarioState(scenario, initial);
+        benchmark::DoNotOptimize(cache.find(serviceKey(initial, scenario), answer));
+    }
+}
+BENCHMARK(BM_ServiceCacheHit)->Arg(4)->Arg(32)->ArgName("size")->Unit(benchmark::kMicrosecond);
+#endif
+
+BENCHMARK_MAIN();
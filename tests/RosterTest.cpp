@@ -0,0 +1,98 @@
+// Loads a roster written by saveRoster, then copies of it with one field corrupted; every copy must be
+// rejected when the scenario is parsed, before any simulation code reads it.
+#include "Lab1.cpp"
+
+static int failures = 0;
+
+static void expect(bool condition, const string& what) {
+    if (!condition) {
+        cerr << "FAIL: " << what << "\n";
+        failures++;
+    }
+}
+
+static string readFile(const string& path) {
+    ifstream in(path, ios::binary);
+    return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+static void writeFile(const string& path, const string& bytes) {
+    ofstream out(path, ios::binary | ios::trunc);
+    out.write(bytes.data(), static_cast<streamsize>(bytes.size()));
+}
+
+static bool parseRoster(const string& path, string& error) {
+    Scenario scenario;
+    istringstream in("rounds 10\nroster " + path + "\n");
+    if (!parseScenario(in, scenario, error)) return false;
+    CombatState state;
+    return scenarioState(scenario, state);
+}
+
+// Byte offset of element `index` of column `id` in a roster image.
+static size_t columnOffset(const string& bytes, uint32_t id, size_t index) {
+    ColumnFileHeader header;
+    memcpy(&header, bytes.data(), sizeof(header));
+    for (uint32_t i = 0; i < header.columnCount; ++i) {
+        ColumnEntry entry;
+        memcpy(&entry, bytes.data() + sizeof(header) + i * sizeof(entry), sizeof(entry));
+        if (entry.id == id) return static_cast<size_t>(entry.offset + index * entry.elementSize);
+    }
+    return bytes.size();
+}
+
+template <typename T>
+static void expectRejected(const string& original, uint32_t id, size_t index, T value, const string& what) {
+    string bytes = original;
+    size_t offset = columnOffset(bytes, id, index);
+    if (offset + sizeof(T) > bytes.size()) {
+        expect(false, what + ": column missing");
+        return;
+    }
+    memcpy(&bytes[offset], &value, sizeof(T));
+    const string path = "roster_test_corrupt.rst";
+    writeFile(path, bytes);
+    string error;
+    expect(!parseRoster(path, error) && !error.empty(), what + " was accepted");
+}
+
+int main() {
+    BattleArena arena;
+    EquipmentCatalog catalog;
+    vector<Character*> group1 = { createCharacterOfClass(arena, CharacterClass::Mage, "Ada", 5, catalog.weapon(0), catalog.armor(1)),
+                                  createCharacterOfClass(arena, CharacterClass::Warrior, "Bo", 7, nullptr, catalog.armor(2)) };
+    vector<Character*> group2 = { createCharacterOfClass(arena, CharacterClass::Archer, "Cy", 6, catalog.weapon(1), nullptr),
+                                  createCharacterOfClass(arena, CharacterClass::Mage, "Di", 4, nullptr, nullptr) };
+    const string path = "roster_test.rst";
+    string error;
+    expect(saveRoster(path, group1, group2, error), "saveRoster: " + error);
+    expect(parseRoster(path, error), "the saved roster was rejected: " + error);
+    const string original = readFile(path);
+
+    expectRejected<int>(original, RosterHitDamage, 0, 0, "a zero hit");
+    expectRejected<int>(original, RosterHitDamage, 5, -3, "a negative hit");
+    expectRejected<int>(original, RosterMaxHealth, 1, 0, "zero health");
+    expectRejected<int>(original, RosterMaxHealth, 2, 1000, "health that does not match the unit");
+    expectRejected<int>(original, RosterAttackDamage, 3, 500, "attack damage that does not match the unit");
+    expectRejected<unsigned char>(original, RosterClass, 0, 7, "an unknown class");
+    expectRejected<int>(original, RosterLevel, 1, MaxLevel + 1, "a level above the cap");
+    expectRejected<int>(original, RosterWeapon, 2, 99, "a weapon outside the list");
+    expectRejected<unsigned char>(original, RosterArmorKind, 3, 200, "an armor kind outside the factor table");
+    expectRejected<uint64_t>(original, RosterNameEnd, 1, 0, "name offsets that go backwards");
+    expectRejected<uint64_t>(original, RosterNameEnd, 3, 1 << 20, "a name past the name bytes");
+
+    // Group sizes in the header that the columns do not have.
+    string resized = original;
+    uint64_t group1Size = 3;
+    memcpy(&resized[offsetof(ColumnFileHeader, meta)], &group1Size, sizeof(group1Size));
+    writeFile("roster_test_corrupt.rst", resized);
+    expect(!parseRoster("roster_test_corrupt.rst", error), "a header with the wrong group sizes was accepted");
+
+    writeFile("roster_test_corrupt.rst", original.substr(0, original.size() / 2));
+    expect(!parseRoster("roster_test_corrupt.rst", error), "a truncated roster was accepted");
+
+    remove(path.c_str());
+    remove("roster_test_corrupt.rst");
+    if (failures == 0) cout << "roster tests passed\n";
+    return failures == 0 ? 0 : 1;
+}